@@ -0,0 +1,233 @@
+//
+// File:  backend.c
+//
+// Timer backends of measurement loop
+//
+
+#define _GNU_SOURCE              // gettid(), sigev_notify_thread_id
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "suppfunc.h"
+#include "backend.h"
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id  _sigev_un._tid
+#endif
+
+#define TIMER_SIGNAL  (SIGRTMIN + 1)
+
+//---------------------------------------------------------------------------
+// clock_nanosleep()
+
+static int nanosleep_init( backend_t *be )
+{
+    return 0;
+}
+
+
+static int nanosleep_wait( backend_t *be, int64_t wake_ns )
+{
+    struct timespec  next = ns2ts( wake_ns );
+    int              err;
+
+    // Error is return value (not errno), absolute time: retry as it is
+    while ( (err = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL)) == EINTR ) {
+        ;
+    }
+    return err ? -1 : 0;
+}
+
+
+static void nanosleep_fini( backend_t *be )
+{
+}
+
+//---------------------------------------------------------------------------
+// timerfd + epoll (event loop style)
+
+static int timerfd_init( backend_t *be )
+{
+    struct epoll_event  ev = { .events = EPOLLIN };
+
+    be->fd   = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK );
+    be->epfd = epoll_create1( 0 );
+    if ( (be->fd < 0) || (be->epfd < 0) ) {
+        perror("timerfd");
+        return -1;
+    }
+    ev.data.fd = be->fd;
+    return epoll_ctl( be->epfd, EPOLL_CTL_ADD, be->fd, &ev );
+}
+
+
+static int timerfd_wait( backend_t *be, int64_t wake_ns )
+{
+    struct itimerspec   its = { { 0, 0 }, ns2ts( wake_ns ) };
+    struct epoll_event  ev;
+    uint64_t            expirations;
+
+    timerfd_settime( be->fd, TFD_TIMER_ABSTIME, &its, NULL );
+    while ( epoll_wait(be->epfd, &ev, 1, -1) < 0 ) {
+        if ( errno != EINTR ) {
+            return -1;
+        }
+    }
+    return (read(be->fd, &expirations, sizeof(expirations)) == sizeof(expirations)) ? 0 : -1;
+}
+
+
+static void timerfd_fini( backend_t *be )
+{
+    close( be->epfd );
+    close( be->fd );
+}
+
+//---------------------------------------------------------------------------
+// POSIX timer signal directed to RT thread
+
+static int signal_init( backend_t *be )
+{
+    struct sigevent  sev;
+
+    sigemptyset( &be->sigset );
+    sigaddset( &be->sigset, TIMER_SIGNAL );
+    pthread_sigmask( SIG_BLOCK, &be->sigset, NULL );
+
+    memset( &sev, 0, sizeof(sev) );
+    sev.sigev_notify           = SIGEV_THREAD_ID;
+    sev.sigev_signo            = TIMER_SIGNAL;
+    sev.sigev_notify_thread_id = syscall( SYS_gettid );
+    if ( timer_create(CLOCK_MONOTONIC, &sev, &be->timer) ) {
+        perror("timer_create");
+        return -1;
+    }
+    return 0;
+}
+
+
+static int signal_wait( backend_t *be, int64_t wake_ns )
+{
+    struct itimerspec  its = { { 0, 0 }, ns2ts( wake_ns ) };
+    siginfo_t          info;
+
+    timer_settime( be->timer, TIMER_ABSTIME, &its, NULL );
+    while ( sigwaitinfo(&be->sigset, &info) < 0 ) {
+        if ( errno != EINTR ) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+static void signal_fini( backend_t *be )
+{
+    timer_delete( be->timer );
+}
+
+//---------------------------------------------------------------------------
+// futex wait with absolute CLOCK_MONOTONIC timeout
+
+static int futex_init( backend_t *be )
+{
+    be->futex = 0;
+    return 0;
+}
+
+
+static int futex_wait( backend_t *be, int64_t wake_ns )
+{
+    struct timespec  next = ns2ts( wake_ns );
+
+    for ( ;; ) {
+        long  ret = syscall( SYS_futex, &be->futex, FUTEX_WAIT_BITSET | FUTEX_PRIVATE_FLAG,
+                             0, &next, NULL, FUTEX_BITSET_MATCH_ANY );
+        if ( (ret < 0) && (errno == ETIMEDOUT) ) {
+            return 0;
+        }
+        if ( (ret < 0) && (errno != EINTR) && (errno != EAGAIN) ) {
+            return -1;
+        }
+    }
+}
+
+
+static void futex_fini( backend_t *be )
+{
+}
+
+//---------------------------------------------------------------------------
+// Condition variable timed wait (CLOCK_MONOTONIC)
+
+static int condvar_init( backend_t *be )
+{
+    pthread_condattr_t  attr;
+
+    pthread_condattr_init( &attr );
+    pthread_condattr_setclock( &attr, CLOCK_MONOTONIC );
+    pthread_cond_init( &be->cond, &attr );
+    pthread_condattr_destroy( &attr );
+    return pthread_mutex_init( &be->mutex, NULL );
+}
+
+
+static int condvar_wait( backend_t *be, int64_t wake_ns )
+{
+    struct timespec  next = ns2ts( wake_ns );
+    int              err;
+
+    pthread_mutex_lock( &be->mutex );
+    do {
+        err = pthread_cond_timedwait( &be->cond, &be->mutex, &next );
+    } while ( !err || (err == EINTR) );
+    pthread_mutex_unlock( &be->mutex );
+    return (err == ETIMEDOUT) ? 0 : -1;
+}
+
+
+static void condvar_fini( backend_t *be )
+{
+    pthread_cond_destroy( &be->cond );
+    pthread_mutex_destroy( &be->mutex );
+}
+
+//---------------------------------------------------------------------------
+
+static backend_ops_t  backends[] = {
+    { "nanosleep", nanosleep_init, nanosleep_wait, nanosleep_fini },
+    { "timerfd",   timerfd_init,   timerfd_wait,   timerfd_fini   },
+    { "signal",    signal_init,    signal_wait,    signal_fini    },
+    { "futex",     futex_init,     futex_wait,     futex_fini     },
+    { "condvar",   condvar_init,   condvar_wait,   condvar_fini   },
+};
+
+#define BACKENDS  (sizeof(backends) / sizeof(backends[0]))
+
+
+backend_ops_t *backend_find( char *name )
+{
+    for ( int ix = 0; ix < BACKENDS; ix++ ) {
+        if ( !strcmp(backends[ix].name, name) ) {
+            return &backends[ix];
+        }
+    }
+    return NULL;
+}
+
+
+char *backend_names( void )
+{
+    return "nanosleep, timerfd, signal, futex, condvar";
+}
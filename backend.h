@@ -0,0 +1,57 @@
+//
+// File:  backend.h
+//
+// Timer backends of measurement loop
+//
+// Each RT thread sleeps to absolute CLOCK_MONOTONIC wake up time through
+// selected backend, all backends feed same metrics:
+//
+//      nanosleep   clock_nanosleep( TIMER_ABSTIME )
+//      timerfd     timerfd (TFD_TIMER_ABSTIME) + epoll_wait()
+//      signal      timer_create( SIGEV_THREAD_ID ) + sigwaitinfo()
+//      futex       FUTEX_WAIT_BITSET timeout (nobody wakes futex)
+//      condvar     pthread_cond_timedwait() (CLOCK_MONOTONIC condattr)
+//
+
+#ifndef  BACKEND_H
+#define  BACKEND_H
+
+#include <stdint.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+typedef struct backend_s  backend_t;
+
+typedef struct  {
+    char   *name;
+    int   (*init)( backend_t *be );                    // Called by RT thread
+    int   (*wait)( backend_t *be, int64_t wake_ns );   // Absolute CLOCK_MONOTONIC
+    void  (*fini)( backend_t *be );
+} backend_ops_t;
+
+struct backend_s  {
+    backend_ops_t    *ops;
+    int               fd;        // timerfd
+    int               epfd;      // epoll
+    timer_t           timer;     // POSIX timer
+    sigset_t          sigset;
+    uint32_t          futex;
+    pthread_mutex_t   mutex;
+    pthread_cond_t    cond;
+};
+
+
+backend_ops_t *backend_find( char *name );
+char          *backend_names( void );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BACKEND_H
@@ -0,0 +1,137 @@
+//  gcc -O2 bench.c suppfunc.c histogram.c task.c tsc.c loadgen.c perf.c -o hrbench -lrt -lpthread
+//
+// Microbenchmarks of measurement primitives: cost per call in ns and in
+// cycle counter ticks, so measurement overhead can be separated from
+// scheduling latency.
+//
+// Output is CSV (one line per benchmark, "#" lines are comments):
+//
+//      bench,calls,ns_per_call,cycles_per_call
+//
+// Usage:  hrbench [calls]      (make bench)
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/utsname.h>
+
+#include "suppfunc.h"
+#include "histogram.h"
+#include "outlier.h"
+#include "tsc.h"
+
+int RT_PERIOD = 2000;           // Unit: [us] (update_metrics)
+
+static volatile int64_t  sink;  // Keep results alive
+static int               calls = 1000000;
+static outlier_ring_t    ring;  // Outlier queue of RT thread
+static outlier_t         rec;
+
+//---------------------------------------------------------------------------
+
+#define BENCH( name, body )                                                 \
+    do {                                                                    \
+        uint64_t  c0 = tsc_source ? tsc_read() : 0;                         \
+        int64_t   t0 = clock_ns( CLOCK_MONOTONIC );                         \
+        for ( int ix = 0; ix < calls; ix++ ) {                              \
+            body;                                                           \
+        }                                                                   \
+        int64_t   t1 = clock_ns( CLOCK_MONOTONIC );                         \
+        uint64_t  c1 = tsc_source ? tsc_read() : 0;                         \
+        printf("%s,%d,%.2f,%.2f\n", name, calls, (double)(t1 - t0) / calls, \
+               (double)(c1 - c0) / calls );                                 \
+    } while ( 0 )
+
+
+int main( int argc, char *argv[] )
+{
+    struct utsname    un;
+    struct timespec   ts, ts2;
+    thread_metrics_t *tm;
+    sample_t          sample = { 0 };
+    metrics_t        *snap;
+    hdr_hist_t        hist;
+    struct rusage     ru = { 0 };
+    perf_t            perf;
+
+    if ( argc > 1 ) {
+        calls = atoi( argv[1] );
+    }
+    if ( calls <= 0 ) {
+        printf("Usage: hrbench [calls]\n");
+        return -1;
+    }
+    tm   = calloc( 1, sizeof(thread_metrics_t) );
+    snap = calloc( 1, sizeof(metrics_t) );
+    if ( !tm || !snap ) {
+        printf("ERROR: Out of memory\n");
+        return -1;
+    }
+    init_metrics( &tm->bank[0], 2 );
+    init_metrics( &tm->bank[1], 2 );
+    init_detail( &tm->detail[0], 2 );
+    init_detail( &tm->detail[1], 2 );
+    tm->period_ns = 1000 * (int64_t)RT_PERIOD;
+    hdr_init( &hist, 2 );
+
+    tsc_init();
+    uname( &un );
+    printf("# hrbench machine=%s kernel=%s clock=%s clock_hz=%ld\n", un.machine, un.release,
+           tsc_name(), (long)(tsc_source ? tsc_calib[tsc_active].hz : 0) );
+    printf("bench,calls,ns_per_call,cycles_per_call\n");
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    ts2 = ts;
+
+    // Time sources
+    BENCH( "clock_gettime", clock_gettime(CLOCK_MONOTONIC, &ts2); sink += ts2.tv_nsec );
+    BENCH( "clock_ns",      sink += clock_ns(CLOCK_MONOTONIC) );
+    BENCH( "tsc_ns",        sink += tsc_ns() );
+
+    // Time arithmetic
+    BENCH( "tsAddus",       ts2 = tsAddus(ts2, 2000); sink += ts2.tv_nsec );
+    BENCH( "tsDiffus",      ts2.tv_nsec ^= ix & 1; sink += tsDiffus(ts, ts2) );
+    BENCH( "ts2us",         ts2.tv_nsec ^= ix & 1; sink += ts2us(ts2) );
+    BENCH( "ts2ns",         ts2.tv_nsec ^= ix & 1; sink += ts2ns(ts2) );
+    BENCH( "ns2ts",         ts2 = ns2ts(ts2ns(ts) + ix); sink += ts2.tv_sec );
+
+    // Histogram: in range and overflow path
+    BENCH( "hdr_record",          hdr_record(&hist, 1000 + (ix & 0xffff)) );
+    BENCH( "hdr_record_overflow", hdr_record(&hist, ((int64_t)1 << 40) + ix) );
+
+    // Per period page fault / context switch accounting of RT thread
+    BENCH( "thread_rusage",       thread_rusage(&ru, &sample) );
+    if ( perf_open(&perf) ) {
+        BENCH( "perf_read",       perf_read(&perf, sample.perf) );
+        perf_close( &perf );
+    }
+    memset( &sample, 0, sizeof(sample) );
+
+    // RT thread metrics update: normal, outlier and reset path (reader
+    // request pending, bank swap on every call). Outlier: every second
+    // sample crosses threshold and is queued to outlier ring (tail follows
+    // head as if logger thread drained it).
+    sample.latency_ns = 20000;
+    BENCH( "update_metrics",
+           sample.now_ns += 2000000; sink += update_metrics(tm, &sample) );
+    BENCH( "update_metrics_outlier",
+           sample.latency_ns = (ix & 1) ? 10000000 : 20000; sample.now_ns += 2000000;
+           if ( update_metrics(tm, &sample) ) { sink += outlier_push(&ring, &rec); ring.tail = ring.head; } );
+    sample.latency_ns = 20000;
+    BENCH( "update_metrics_reset",
+           tm->reset_req++; sample.now_ns += 2000000; sink += update_metrics(tm, &sample) );
+
+    // Reader side
+    int  reader_calls = calls;
+
+    calls = (calls / 1000) ? calls / 1000 : 1;
+    BENCH( "snapshot_metrics", sink += snapshot_metrics(tm, snap, NULL) );
+    BENCH( "reset_metrics",    sink += reset_metrics(tm); tm->reset_ack = tm->reset_req );
+    calls = reader_calls;
+
+    free( snap );
+    free( tm );
+    return 0;
+}
@@ -0,0 +1,202 @@
+//
+// File:  export.c
+//
+// OpenMetrics exporter on Unix domain socket
+//
+
+#define _GNU_SOURCE              // open_memstream()
+
+#include <stdint.h>
+#include <stddef.h>               // offsetof()
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "suppfunc.h"
+#include "export.h"
+
+#define EXPORT_BUCKETS  (HDR_MAX_MAGNITUDE + 1)   // le = 2^0 ... 2^32 ns
+
+//---------------------------------------------------------------------------
+
+static void labels( char *buf, size_t size, shm_metrics_t *shm, int th )
+{
+    int  len = snprintf( buf, size, "thread=\"%d\",cpu=\"%d\",backend=\"%s\"", th,
+                         shm->thread[th].cpu, shm->thread[th].backend );
+
+    if ( shm->thread[th].ipc[0] ) {
+        snprintf( buf + len, size - len, ",ipc=\"%s\"", shm->thread[th].ipc );
+    }
+}
+
+
+static void counter( FILE *f, char *name, char *help, shm_metrics_t *shm,
+                     metrics_t *snap, size_t offset, int is64 )
+{
+    char  lbl[192];
+
+    fprintf( f, "# TYPE hrtimer_%s counter\n# HELP hrtimer_%s %s\n", name, name, help );
+    for ( int th = 0; th < shm->nthreads; th++ ) {
+        char  *field = (char *)&snap[th] + offset;
+
+        labels( lbl, sizeof(lbl), shm, th );
+        fprintf( f, "hrtimer_%s_total{%s} %ld\n", name, lbl,
+                 is64 ? (long)*(int64_t *)field : (long)*(int *)field );
+    }
+}
+
+#define COUNTER( f, name, help, shm, snap, field )                              \
+        counter( f, name, help, shm, snap, offsetof(metrics_t, field),         \
+                 sizeof(((metrics_t *)0)->field) == sizeof(int64_t) )
+
+
+// Write OpenMetrics text of all RT threads to "f"
+
+void export_metrics( FILE *f, shm_metrics_t *shm )
+{
+    int         n    = shm->nthreads;
+    metrics_t  *snap = calloc( n, sizeof(metrics_t) );
+    char        lbl[192];
+
+    if ( !snap ) {
+        return;
+    }
+    for ( int th = 0; th < n; th++ ) {
+        snapshot_metrics( &shm->thread[th], &snap[th], NULL );
+    }
+
+    fprintf( f, "# TYPE hrtimer_latency_seconds histogram\n" );
+    fprintf( f, "# UNIT hrtimer_latency_seconds seconds\n" );
+    fprintf( f, "# HELP hrtimer_latency_seconds Wake up latency of RT thread.\n" );
+    for ( int th = 0; th < n; th++ ) {
+        hdr_hist_t  *h   = &snap[th].hist;
+        int64_t      sum = h->underflow;
+        int          ix  = 0;
+
+        labels( lbl, sizeof(lbl), shm, th );
+        // Cumulative count of values <= 2^k ns (k == bucket, "le" is inclusive)
+        for ( int k = 0; k < EXPORT_BUCKETS; k++ ) {
+            while ( (ix < h->counts_len) && (hdr_highest_at(h, ix) <= ((int64_t)1 << k)) ) {
+                sum += h->counts[ix++];
+            }
+            fprintf( f, "hrtimer_latency_seconds_bucket{%s,le=\"%.9g\"} %ld\n", lbl,
+                     (double)((int64_t)1 << k) / 1e9, (long)sum );
+        }
+        fprintf( f, "hrtimer_latency_seconds_bucket{%s,le=\"+Inf\"} %ld\n", lbl, (long)h->total );
+        fprintf( f, "hrtimer_latency_seconds_count{%s} %ld\n", lbl, (long)h->total );
+        fprintf( f, "hrtimer_latency_seconds_sum{%s} %.9f\n", lbl, snap[th].sum_ns / 1e9 );
+    }
+
+    fprintf( f, "# TYPE hrtimer_latency_max_seconds gauge\n" );
+    fprintf( f, "# UNIT hrtimer_latency_max_seconds seconds\n" );
+    fprintf( f, "# HELP hrtimer_latency_max_seconds Max wake up latency since reset.\n" );
+    for ( int th = 0; th < n; th++ ) {
+        labels( lbl, sizeof(lbl), shm, th );
+        fprintf( f, "hrtimer_latency_max_seconds{%s} %.9f\n", lbl, snap[th].hist.max / 1e9 );
+    }
+
+    COUNTER( f, "samples",        "Wake ups of RT thread.", shm, snap, counter );
+    COUNTER( f, "missed_periods", "Missed periods (overrun policy).", shm, snap, missed );
+    COUNTER( f, "spin_miss",      "Hybrid sleep woke up after deadline.", shm, snap, spin_miss );
+    COUNTER( f, "dl_throttled",   "SCHED_DEADLINE runtime overruns.", shm, snap, dl_throttled );
+    COUNTER( f, "dl_missed",      "SCHED_DEADLINE jobs done after deadline.", shm, snap, dl_missed );
+    COUNTER( f, "minor_faults",   "Minor page faults of RT thread.", shm, snap, minflt );
+    COUNTER( f, "major_faults",   "Major page faults of RT thread.", shm, snap, majflt );
+    COUNTER( f, "involuntary_switches", "Involuntary context switches of RT thread.", shm, snap, nivcsw );
+
+    fprintf( f, "# TYPE hrtimer_overrun_bursts counter\n" );
+    fprintf( f, "# HELP hrtimer_overrun_bursts Overrun bursts (late_count).\n" );
+    for ( int th = 0; th < n; th++ ) {
+        labels( lbl, sizeof(lbl), shm, th );
+        fprintf( f, "hrtimer_overrun_bursts_total{%s} %ld\n", lbl, (long)snap[th].burst.total );
+    }
+    fprintf( f, "# EOF\n" );
+    free( snap );
+}
+
+//---------------------------------------------------------------------------
+
+// Create listening socket "path" (old socket file is replaced).
+// Return socket, -1 on error.
+
+int export_open( char *path )
+{
+    struct sockaddr_un  addr = { .sun_family = AF_UNIX };
+    int                 fd   = socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+
+    if ( fd < 0 ) {
+        perror("socket");
+        return -1;
+    }
+    strncpy( addr.sun_path, path, sizeof(addr.sun_path) - 1 );
+    unlink( path );
+    if ( bind(fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(fd, 8) ) {
+        perror("export socket");
+        close( fd );
+        return -1;
+    }
+    return fd;
+}
+
+
+// Serve one client if connected within "timeout_ms".
+// Return 1 when client is served, 0 on timeout, -1 on error.
+
+int export_poll( int fd, shm_metrics_t *shm, int timeout_ms )
+{
+    struct pollfd  pfd = { fd, POLLIN, 0 };
+    char           req[256];
+    char          *text = NULL;
+    size_t         len  = 0;
+    int            http = 0;
+
+    if ( poll(&pfd, 1, timeout_ms) <= 0 ) {
+        return 0;
+    }
+    int  client = accept( fd, NULL, NULL );
+    if ( client < 0 ) {
+        return -1;
+    }
+    // HTTP client sends request first, raw client (socat) may send nothing
+    pfd.fd = client;
+    if ( (poll(&pfd, 1, 100) > 0) && (read(client, req, sizeof(req) - 1) > 0) ) {
+        http = !strncmp( req, "GET ", 4 );
+    }
+
+    FILE  *f = open_memstream( &text, &len );
+    if ( f ) {
+        export_metrics( f, shm );
+        fclose( f );
+        if ( http ) {
+            char  hdr[256];
+            int   n = snprintf( hdr, sizeof(hdr), "HTTP/1.0 200 OK\r\n"
+                                "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+                                "Content-Length: %zu\r\n\r\n", len );
+
+            send( client, hdr, n, MSG_NOSIGNAL );
+        }
+        // MSG_NOSIGNAL: client gone is not SIGPIPE
+        for ( size_t off = 0; off < len; ) {
+            ssize_t  w = send( client, text + off, len - off, MSG_NOSIGNAL );
+
+            if ( w <= 0 ) {
+                break;
+            }
+            off += w;
+        }
+        free( text );
+    }
+    close( client );
+    return 1;
+}
+
+
+void export_close( int fd, char *path )
+{
+    close( fd );
+    unlink( path );
+}
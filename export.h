@@ -0,0 +1,37 @@
+//
+// File:  export.h
+//
+// OpenMetrics exporter on Unix domain socket
+//
+// Each client connection gets OpenMetrics text built from seqlock snapshots
+// of shared memory (exporter never blocks or writes RT threads). Client
+// sending HTTP "GET" gets HTTP/1.0 response, other clients raw text:
+//
+//      curl --unix-socket /run/hrtimer.sock http://localhost/metrics
+//      socat - UNIX-CONNECT:/run/hrtimer.sock
+//
+// Latency histogram buckets are power of two ranges of HDR histogram
+// (le = 2^k ns, same set on every scrape), labels: thread, cpu, backend.
+//
+
+#ifndef  EXPORT_H
+#define  EXPORT_H
+
+#include <stdio.h>
+#include "suppfunc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+int   export_open( char *path );
+int   export_poll( int fd, shm_metrics_t *shm, int timeout_ms );
+void  export_close( int fd, char *path );
+void  export_metrics( FILE *f, shm_metrics_t *shm );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // EXPORT_H
@@ -0,0 +1,205 @@
+//
+// File:  ftrace.c
+//
+// Ftrace breaktrace (see ftrace.h)
+//
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "ftrace.h"
+
+#define MAX_PATH        256
+#define NEVENTS         (int)(sizeof(events) / sizeof(events[0]))
+
+static char  tracefs[MAX_PATH];
+static int   marker_fd = -1;
+static int   on_fd     = -1;
+static int   broken;                   // First breaking thread wins
+
+static struct {                        // Written once by breaking thread
+    int      thread;
+    int64_t  latency_ns;
+    int64_t  time_ns;
+} breach;
+
+// Events that show what kernel was doing before spike
+static char *events[] = {
+    "sched/sched_switch", "sched/sched_wakeup", "sched/sched_migrate_task",
+    "irq/irq_handler_entry", "irq/irq_handler_exit", "irq/softirq_entry", "irq/softirq_exit",
+    "timer/hrtimer_expire_entry", "timer/hrtimer_expire_exit",
+};
+
+// State before ftrace_init(), restored by ftrace_fini()
+static char  old_tracer[64];           // "" == not changed
+static char  old_enable[NEVENTS];      // '0' == event was off, 0 == not changed
+
+//---------------------------------------------------------------------------
+
+// Write "value" to tracefs file "name", return 0 on success
+
+static int tracefs_write( char *name, char *value )
+{
+    char  path[2 * MAX_PATH];
+    int   fd, len = strlen( value );
+
+    snprintf( path, sizeof(path), "%s/%s", tracefs, name );
+    fd = open( path, O_WRONLY | O_TRUNC );
+    if ( fd < 0 ) {
+        return -1;
+    }
+    if ( write(fd, value, len) != len ) {
+        close( fd );
+        return -1;
+    }
+    close( fd );
+    return 0;
+}
+
+
+// Read first line of tracefs file "name" to "value", return 0 on success
+
+static int tracefs_read( char *name, char *value, int size )
+{
+    char  path[2 * MAX_PATH];
+    int   fd, len;
+
+    snprintf( path, sizeof(path), "%s/%s", tracefs, name );
+    fd = open( path, O_RDONLY );
+    if ( fd < 0 ) {
+        return -1;
+    }
+    len = read( fd, value, size - 1 );
+    close( fd );
+    if ( len < 0 ) {
+        return -1;
+    }
+    value[len] = '\0';
+    value[strcspn(value, "\n")] = '\0';
+    return 0;
+}
+
+
+// Set up tracer and events, clear buffer, start tracing.
+// Return 0 on success.
+
+int ftrace_init( ft_config_t *cfg )
+{
+    char  *tracer = cfg->tracer ? cfg->tracer : "nop";
+    char   path[2 * MAX_PATH];
+    int    nevents = 0;
+
+    if ( cfg->path ) {
+        strncpy( tracefs, cfg->path, sizeof(tracefs) - 1 );
+    }
+    else {
+        // tracefs mount point since 4.1, debugfs before
+        strcpy( tracefs, access("/sys/kernel/tracing/tracing_on", F_OK) ?
+                         "/sys/kernel/debug/tracing" : "/sys/kernel/tracing" );
+    }
+
+    if ( tracefs_write("tracing_on", "0") ) {
+        printf("ERROR: No tracefs in %s (mount -t tracefs nodev /sys/kernel/tracing)\n", tracefs);
+        return -1;
+    }
+    if ( tracefs_read("current_tracer", old_tracer, sizeof(old_tracer)) ||
+         !strcmp(old_tracer, tracer) ) {
+        old_tracer[0] = '\0';
+    }
+    if ( tracefs_write("current_tracer", tracer) ) {
+        printf("ERROR: Tracer %s not available (see %s/available_tracers)\n", tracer, tracefs);
+        old_tracer[0] = '\0';
+        return -1;
+    }
+    for ( int ix = 0; ix < NEVENTS; ix++ ) {
+        char  enable[8];
+
+        snprintf( path, sizeof(path), "events/%s/enable", events[ix] );
+        old_enable[ix] = (!tracefs_read(path, enable, sizeof(enable)) && (enable[0] == '0')) ? '0' : 0;
+        if ( tracefs_write(path, "1") ) {
+            old_enable[ix] = 0;
+            continue;
+        }
+        nevents++;
+    }
+    if ( !nevents && !strcmp(tracer, "nop") ) {
+        printf("WARNING: No trace events enabled, trace will have markers only\n");
+    }
+    tracefs_write( "trace", "" );
+
+    snprintf( path, sizeof(path), "%s/trace_marker", tracefs );
+    marker_fd = open( path, O_WRONLY | O_APPEND );
+    snprintf( path, sizeof(path), "%s/tracing_on", tracefs );
+    on_fd     = open( path, O_WRONLY );
+    if ( (marker_fd < 0) || (on_fd < 0) || (pwrite(on_fd, "1", 1, 0) != 1) ) {
+        perror( path );
+        ftrace_fini();
+        return -1;
+    }
+    printf("Breaktrace    : latency > %.1f us, tracer %s, %d events, %s\n",
+           cfg->limit_ns / 1000.0, tracer, nevents, tracefs);
+    return 0;
+}
+
+
+// RT thread: latency above limit. Write marker and stop tracing, only
+// first call does it. Return 1 when this call stopped tracing.
+
+int ftrace_break( int thread, int64_t latency_ns, int64_t now_ns )
+{
+    char  txt[128];
+    int   len;
+
+    if ( (on_fd < 0) || __atomic_exchange_n(&broken, 1, __ATOMIC_ACQ_REL) ) {
+        return 0;
+    }
+    len = snprintf( txt, sizeof(txt), "hrtimer: break thread %d latency %ld ns\n",
+                    thread, (long)latency_ns );
+    write( marker_fd, txt, len );
+    pwrite( on_fd, "0", 1, 0 );
+
+    breach.thread     = thread;
+    breach.latency_ns = latency_ns;
+    breach.time_ns    = now_ns;
+    return 1;
+}
+
+
+// Stop tracing (trace of whole run is kept when limit was not hit),
+// disable events and restore tracer which were changed by ftrace_init().
+// Other tracer than before clears trace buffer (kernel does it on switch).
+
+void ftrace_fini( void )
+{
+    char  path[2 * MAX_PATH];
+
+    if ( on_fd >= 0 ) {
+        pwrite( on_fd, "0", 1, 0 );
+        close( on_fd );
+    }
+    for ( int ix = 0; ix < NEVENTS; ix++ ) {
+        if ( old_enable[ix] ) {
+            snprintf( path, sizeof(path), "events/%s/enable", events[ix] );
+            tracefs_write( path, "0" );
+            old_enable[ix] = 0;
+        }
+    }
+    if ( old_tracer[0] ) {
+        tracefs_write( "current_tracer", old_tracer );
+        old_tracer[0] = '\0';
+    }
+    if ( marker_fd >= 0 ) {
+        close( marker_fd );
+    }
+    if ( __atomic_load_n(&broken, __ATOMIC_ACQUIRE) ) {
+        printf("Breaktrace    : thread %d latency %.3f us at %ld.%09ld, see %s/trace\n",
+               breach.thread, breach.latency_ns / 1000.0, (long)(breach.time_ns / 1000000000),
+               (long)(breach.time_ns % 1000000000), tracefs);
+    }
+    on_fd     = -1;
+    marker_fd = -1;
+}
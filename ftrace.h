@@ -0,0 +1,49 @@
+//
+// File:  ftrace.h
+//
+// Ftrace breaktrace (like cyclictest -b)
+//
+// Setup before RT threads start (tracefs == /sys/kernel/tracing, or
+// /sys/kernel/debug/tracing on old kernels, or stand-in directory):
+//
+//      tracing_on          0 while setup, then 1
+//      current_tracer      given tracer (default nop)
+//      events/.../enable   scheduler, IRQ and hrtimer events
+//      trace               cleared
+//
+// ftrace_fini() disables events which were off and restores tracer which
+// was set before (trace buffer is kept unless tracer is switched back).
+//
+// First RT thread with latency above limit writes marker to trace_marker
+// and writes 0 to tracing_on: trace buffer ends with events that led to
+// the spike. Only file descriptors opened at setup are used in RT thread.
+//
+//      cat /sys/kernel/tracing/trace
+//
+
+#ifndef  FTRACE_H
+#define  FTRACE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+typedef struct  {
+    char     *path;            // tracefs directory, NULL == auto
+    char     *tracer;          // current_tracer, NULL == nop
+    int64_t   limit_ns;        // Break when latency > limit
+} ft_config_t;
+
+
+int   ftrace_init( ft_config_t *cfg );
+int   ftrace_break( int thread, int64_t latency_ns, int64_t now_ns );
+void  ftrace_fini( void );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FTRACE_H
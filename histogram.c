@@ -0,0 +1,245 @@
+//
+// File:  histogram.c
+//
+// Log-linear (HDR style) latency histogram, reader side functions
+//
+
+#include <stdint.h>
+#include <string.h>         // memset()
+
+#include "histogram.h"
+
+//---------------------------------------------------------------------------
+
+int hdr_init( hdr_hist_t *h, int digits )
+{
+    if ( (digits < 1) || (digits > HDR_MAX_DIGITS) ) {
+        return -1;
+    }
+    memset( h, 0, sizeof(hdr_hist_t) );
+
+    int  sub_magnitude = HDR_SUB_MAGNITUDE( digits );
+
+    h->digits          = digits;
+    h->half_magnitude  = sub_magnitude - 1;
+    h->half_count      = 1 << h->half_magnitude;
+    h->sub_bucket_mask = (1 << sub_magnitude) - 1;
+    h->counts_len      = HDR_COUNTS_LEN( digits );
+    return 0;
+}
+
+
+// Clear recorded values, keep layout
+
+void hdr_clear( hdr_hist_t *h )
+{
+    int  digits = h->digits;
+
+    if ( hdr_init(h, digits) ) {
+        hdr_init( h, HDR_MAX_DIGITS );
+    }
+}
+
+//---------------------------------------------------------------------------
+// Convert counts[] index to value range [hdr_value_at() ... hdr_highest_at()]
+
+static int bucket_of( hdr_hist_t *h, int index, int *sub_bucket )
+{
+    int  bucket = (index >> h->half_magnitude) - 1;
+
+    *sub_bucket = (index & (h->half_count - 1)) + h->half_count;
+    if ( bucket < 0 ) {
+        *sub_bucket -= h->half_count;
+        bucket = 0;
+    }
+    return bucket;
+}
+
+
+int64_t hdr_value_at( hdr_hist_t *h, int index )
+{
+    int  sub_bucket;
+    int  bucket = bucket_of( h, index, &sub_bucket );
+
+    return (int64_t)sub_bucket << bucket;
+}
+
+
+int64_t hdr_highest_at( hdr_hist_t *h, int index )
+{
+    int  sub_bucket;
+    int  bucket = bucket_of( h, index, &sub_bucket );
+
+    return ((int64_t)sub_bucket << bucket) + ((int64_t)1 << bucket) - 1;
+}
+
+//---------------------------------------------------------------------------
+
+void hdr_record_n( hdr_hist_t *h, int64_t value, int64_t n )
+{
+    if ( n <= 0 ) {
+        return;
+    }
+    if ( value < 0 ) {
+        h->underflow += n;
+    }
+    else if ( value >> HDR_MAX_MAGNITUDE ) {
+        h->overflow += n;
+    }
+    else {
+        h->counts[ hdr_index(h, value) ] += n;
+    }
+    if ( !h->total ) {
+        h->min = h->max = value;
+    }
+    if ( value < h->min ) {
+        h->min = value;
+    }
+    if ( value > h->max ) {
+        h->max = value;
+    }
+    h->total += n;
+}
+
+
+// Accumulate "src" into "dst". Histograms with different significant digits
+// are merged value by value (src bucket value recorded into dst).
+
+void hdr_merge( hdr_hist_t *dst, hdr_hist_t *src )
+{
+    if ( !src->total ) {
+        return;
+    }
+    if ( !dst->digits ) {
+        hdr_init( dst, src->digits );
+    }
+    if ( dst->digits != src->digits ) {
+        int64_t  total = dst->total, min = dst->min, max = dst->max;
+
+        for ( int ix = 0; ix < src->counts_len; ix++ ) {
+            hdr_record_n( dst, hdr_value_at(src, ix), src->counts[ix] );
+        }
+        hdr_record_n( dst, -1, src->underflow );
+        hdr_record_n( dst, (int64_t)1 << HDR_MAX_MAGNITUDE, src->overflow );
+
+        // Bucket values are not exact, keep exact min and max
+        dst->min = (total && (min < src->min)) ? min : src->min;
+        dst->max = (total && (max > src->max)) ? max : src->max;
+        return;
+    }
+
+    for ( int ix = 0; ix < src->counts_len; ix++ ) {
+        dst->counts[ix] += src->counts[ix];
+    }
+    if ( !dst->total || (src->min < dst->min) ) {
+        dst->min = src->min;
+    }
+    if ( !dst->total || (src->max > dst->max) ) {
+        dst->max = src->max;
+    }
+    dst->underflow += src->underflow;
+    dst->overflow  += src->overflow;
+    dst->total     += src->total;
+}
+
+
+// "dst" = values recorded to "now" after older snapshot "prev" of same
+// histogram. Min and max are bucket bounds unless interval set new extreme.
+
+void hdr_delta( hdr_hist_t *dst, hdr_hist_t *now, hdr_hist_t *prev )
+{
+    int  lo = -1, hi = -1;
+
+    hdr_init( dst, now->digits );
+    for ( int ix = 0; ix < now->counts_len; ix++ ) {
+        dst->counts[ix] = now->counts[ix] - prev->counts[ix];
+        if ( dst->counts[ix] ) {
+            if ( lo < 0 ) {
+                lo = ix;
+            }
+            hi = ix;
+        }
+    }
+    dst->underflow = now->underflow - prev->underflow;
+    dst->overflow  = now->overflow  - prev->overflow;
+    dst->total     = now->total     - prev->total;
+    if ( !dst->total ) {
+        return;
+    }
+    if ( !prev->total || (now->min < prev->min) || dst->underflow || (lo < 0) ) {
+        dst->min = now->min;
+    }
+    else {
+        dst->min = hdr_value_at( now, lo );
+        dst->min = (dst->min > now->min) ? dst->min : now->min;
+    }
+    if ( !prev->total || (now->max > prev->max) || dst->overflow || (hi < 0) ) {
+        dst->max = now->max;
+    }
+    else {
+        dst->max = hdr_highest_at( now, hi );
+        dst->max = (dst->max < now->max) ? dst->max : now->max;
+    }
+}
+
+
+// Values at several ascending percentiles in one pass over counts
+
+void hdr_percentiles( hdr_hist_t *h, double *percentile, int64_t *value, int count )
+{
+    int64_t  sum = h->underflow;
+    int      ix  = 0;
+
+    for ( int p = 0; p < count; p++ ) {
+        int64_t  target = (int64_t)((percentile[p] / 100.0) * h->total + 0.5);
+
+        if ( !h->total ) {
+            value[p] = 0;
+            continue;
+        }
+        if ( target < 1 ) {
+            target = 1;
+        }
+        if ( sum >= target ) {
+            value[p] = ix ? hdr_highest_at( h, ix - 1 ) : h->min;
+            value[p] = (value[p] < h->max) ? value[p] : h->max;
+            continue;
+        }
+        while ( (ix < h->counts_len) && (sum < target) ) {
+            sum += h->counts[ix++];
+        }
+        value[p] = (sum >= target) ? hdr_highest_at( h, ix - 1 ) : h->max;
+        value[p] = (value[p] < h->max) ? value[p] : h->max;
+    }
+}
+
+
+// Return value (highest equivalent value of bucket) at given percentile 0...100
+
+int64_t hdr_percentile( hdr_hist_t *h, double percentile )
+{
+    if ( !h->total ) {
+        return 0;
+    }
+    if ( percentile > 100.0 ) {
+        percentile = 100.0;
+    }
+    int64_t  target = (int64_t)((percentile / 100.0) * h->total + 0.5);
+    int64_t  sum    = h->underflow;
+
+    if ( target < 1 ) {
+        target = 1;
+    }
+    if ( sum >= target ) {
+        return h->min;
+    }
+    for ( int ix = 0; ix < h->counts_len; ix++ ) {
+        sum += h->counts[ix];
+        if ( sum >= target ) {
+            int64_t  value = hdr_highest_at( h, ix );
+
+            return (value < h->max) ? value : h->max;
+        }
+    }
+    return h->max;
+}
@@ -0,0 +1,105 @@
+//
+// File:  histogram.h
+//
+// Log-linear (HDR style) latency histogram
+//
+// Values are recorded with "digits" significant decimal digits from 1 ns
+// up to 2^HDR_MAX_MAGNITUDE ns (~4.3 s). Each power of two range is split
+// to linear sub buckets, so relative error is constant over whole range.
+// Recording is O(1): count leading zeros, shift and add (no division).
+//
+// Histogram has fixed size (it lives in shared memory). Count of used
+// counters depends on run time selected "digits" (1...HDR_MAX_DIGITS).
+// Header (layout and totals) fills exactly one cache line, so recording
+// touches header line and one counter line.
+//
+
+#ifndef  HISTOGRAM_H
+#define  HISTOGRAM_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#ifndef HDR_MAX_DIGITS
+#define HDR_MAX_DIGITS      2      // Max significant digits: 2 == 26 KB histogram (3 == 184 KB)
+#endif
+#define HDR_MAX_MAGNITUDE   32     // Highest trackable value 2^32-1 [ns]
+
+// log2 of sub bucket count: 2 * 10^digits rounded up to power of two
+#define HDR_SUB_MAGNITUDE(d)  ((d) == 1 ? 5 : (d) == 2 ? 8 : 11)
+#define HDR_COUNTS_LEN(d)     ((HDR_MAX_MAGNITUDE - HDR_SUB_MAGNITUDE(d) + 2) << (HDR_SUB_MAGNITUDE(d) - 1))
+#define HDR_COUNTS_MAX        HDR_COUNTS_LEN(HDR_MAX_DIGITS)
+
+#ifndef CACHE_LINE
+#define CACHE_LINE          64
+#endif
+
+typedef struct  {
+    int32_t   digits;             // Significant decimal digits
+    int32_t   half_magnitude;     // log2 of sub bucket half count
+    int32_t   half_count;         // Sub bucket half count
+    int32_t   counts_len;         // Used entries of "counts[]"
+    int64_t   sub_bucket_mask;
+    //
+    int64_t   total;              // Count of all recorded values
+    int64_t   min, max;           // Exact min and max of recorded values
+    int64_t   underflow;          // Count of values < 0
+    int64_t   overflow;           // Count of values >= 2^HDR_MAX_MAGNITUDE
+    uint64_t  counts[HDR_COUNTS_MAX];   // 64 bit: merged fleet counts never wrap
+} __attribute__((aligned(CACHE_LINE))) hdr_hist_t;
+
+
+int      hdr_init( hdr_hist_t *h, int digits );
+void     hdr_clear( hdr_hist_t *h );
+void     hdr_merge( hdr_hist_t *dst, hdr_hist_t *src );
+void     hdr_delta( hdr_hist_t *dst, hdr_hist_t *now, hdr_hist_t *prev );
+int64_t  hdr_percentile( hdr_hist_t *h, double percentile );
+void     hdr_percentiles( hdr_hist_t *h, double *percentile, int64_t *value, int count );
+int64_t  hdr_value_at( hdr_hist_t *h, int index );
+int64_t  hdr_highest_at( hdr_hist_t *h, int index );
+void     hdr_record_n( hdr_hist_t *h, int64_t value, int64_t n );
+
+
+static inline int hdr_index( hdr_hist_t *h, int64_t value )
+{
+    int  pow2ceiling = 64 - __builtin_clzll( value | h->sub_bucket_mask );
+    int  bucket      = pow2ceiling - (h->half_magnitude + 1);
+    int  sub_bucket  = (int)(value >> bucket);
+
+    return ((bucket + 1) << h->half_magnitude) + (sub_bucket - h->half_count);
+}
+
+
+// Hot path: called from RT thread for each sample
+
+static inline void hdr_record( hdr_hist_t *h, int64_t value )
+{
+    if ( value < 0 ) {
+        h->underflow++;
+    }
+    else if ( value >> HDR_MAX_MAGNITUDE ) {
+        h->overflow++;
+    }
+    else {
+        h->counts[ hdr_index(h, value) ]++;
+    }
+    if ( !h->total++ ) {
+        h->min = h->max = value;
+    }
+    else if ( value < h->min ) {
+        h->min = value;
+    }
+    else if ( value > h->max ) {
+        h->max = value;
+    }
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HISTOGRAM_H
@@ -0,0 +1,353 @@
+//  gcc hragg.c suppfunc.c histogram.c task.c tsc.c loadgen.c perf.c -O2 -o hragg -lrt -lpthread
+//
+// Fleet aggregator of hrtimer metrics: merges histograms and counters of
+// hrtimer instances (hrtimer -N name) and dump files (hrtimer -d file)
+//
+// Usage:  hragg [-q] [-o file] [-i sec] [input ...]
+//
+//      input    shared memory name (/dev/shm/name), dump file or directory
+//               of them (default: all hrtimer segments in /dev/shm)
+//      -q       print total only (no line per input)
+//      -o file  write total as dump file with one thread (input of next
+//               hragg level, e.g. boards -> rack -> fleet)
+//      -i sec   repeat every "sec" seconds, inputs are discovered again
+//
+// Inputs are mapped read only and each RT thread is copied with seqlock
+// snapshot, so running instances are never blocked. Inputs are merged in
+// one pass (histograms bucket by bucket, hdr_merge), fleet percentiles
+// come from merged histogram. Files in directories which are not hrtimer
+// metrics (magic, layout size) are skipped.
+//
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "suppfunc.h"
+
+#define SHM_DIR  "/dev/shm"
+
+int RT_PERIOD = 0;                      // Unit: [us] (suppfunc.c, not used)
+
+typedef struct  {
+    char  path[512];
+    int   given;                        // Named on command line (warn when not metrics)
+} input_t;
+
+static input_t    *inputs;
+static int         ninputs, max_inputs;
+static int         quiet;
+static metrics_t  *snap, *part, *total; // Snapshot of thread, input, all inputs
+static int64_t     worst_ns;            // Max latency of all threads
+static char       *worst;               // Input of max latency
+static int64_t     period_ns;           // Common RT period (0 == no input yet, -1 == mixed)
+static int         perf_mask;
+
+//---------------------------------------------------------------------------
+
+static void add_input( char *path, int given )
+{
+    if ( ninputs == max_inputs ) {
+        max_inputs = max_inputs ? 2 * max_inputs : 64;
+        inputs     = realloc( inputs, max_inputs * sizeof(input_t) );
+        if ( !inputs ) {
+            printf("ERROR: Out of memory\n");
+            exit( -1 );
+        }
+    }
+    snprintf( inputs[ninputs].path, sizeof(inputs[ninputs].path), "%s", path );
+    inputs[ninputs].given = given;
+    ninputs++;
+}
+
+
+// Regular files of directory in name order ("*.tmp" is dump in progress)
+
+static void scan_dir( char *dir )
+{
+    struct dirent  **list;
+    int              n = scandir( dir, &list, NULL, alphasort );
+
+    if ( n < 0 ) {
+        perror( dir );
+        return;
+    }
+    for ( int ix = 0; ix < n; ix++ ) {
+        char        *name = list[ix]->d_name;
+        size_t       len  = strlen( name );
+        char         path[512];
+        struct stat  st;
+
+        snprintf( path, sizeof(path), "%s/%s", dir, name );
+        if ( !stat(path, &st) && S_ISREG(st.st_mode) &&
+             !((len > 4) && !strcmp(name + len - 4, ".tmp")) ) {
+            add_input( path, 0 );
+        }
+        free( list[ix] );
+    }
+    free( list );
+}
+
+
+static void find_inputs( int argc, char *argv[] )
+{
+    ninputs = 0;
+    if ( !argc ) {
+        scan_dir( SHM_DIR );
+        return;
+    }
+    for ( int ix = 0; ix < argc; ix++ ) {
+        char         path[512];
+        struct stat  st;
+
+        // Plain name which is not a file here: shared memory instance
+        if ( !strchr(argv[ix], '/') && stat(argv[ix], &st) ) {
+            snprintf( path, sizeof(path), "%s/%s", SHM_DIR, argv[ix] );
+        }
+        else {
+            snprintf( path, sizeof(path), "%s", argv[ix] );
+        }
+        if ( !stat(path, &st) && S_ISDIR(st.st_mode) ) {
+            scan_dir( path );
+        }
+        else {
+            add_input( path, 1 );
+        }
+    }
+}
+
+//---------------------------------------------------------------------------
+
+// Merge snapshots of all RT threads of input to "dst".
+// Return count of threads, 0 when input is not hrtimer metrics.
+
+static int read_input( input_t *in, metrics_t *dst )
+{
+    struct stat     st;
+    shm_metrics_t  *shm;
+    int             fd = open( in->path, O_RDONLY );
+    int             n  = 0;
+
+    if ( fd < 0 ) {
+        if ( in->given ) {
+            perror( in->path );
+        }
+        return 0;
+    }
+    if ( fstat(fd, &st) || (st.st_size < (off_t)sizeof(shm_metrics_t)) ) {
+        close( fd );
+        return 0;
+    }
+    shm = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+    close( fd );
+    if ( shm == MAP_FAILED ) {
+        return 0;
+    }
+    if ( (shm->magic == SHM_MAGIC) && (shm->size == sizeof(thread_metrics_t)) &&
+         (shm->nthreads > 0) && (shm->nthreads <= MAX_RT_THREADS) &&
+         (st.st_size >= (off_t)SHM_METRICS_SIZE(shm->nthreads)) ) {
+        n = shm->nthreads;
+    }
+    for ( int th = 0; th < n; th++ ) {
+        thread_metrics_t  *tm = &shm->thread[th];
+
+        if ( snapshot_metrics(tm, snap, NULL) ) {
+            printf("WARNING: %s: Inconsistent snapshot of thread %d\n", in->path, th);
+        }
+        merge_metrics( dst, snap );
+        if ( snap->counter && (snap->hist.max > worst_ns) ) {
+            worst_ns = snap->hist.max;
+            worst    = in->path;
+        }
+        if ( period_ns >= 0 ) {
+            period_ns = (!period_ns || (period_ns == tm->period_ns)) ? tm->period_ns : -1;
+        }
+        perf_mask |= tm->perf_mask;
+    }
+    munmap( shm, st.st_size );
+    if ( !n && in->given ) {
+        printf("WARNING: %s is not hrtimer metrics\n", in->path);
+    }
+    return n;
+}
+
+
+static char *label( char *path )
+{
+    return strncmp(path, SHM_DIR "/", sizeof(SHM_DIR)) ? path : path + sizeof(SHM_DIR);
+}
+
+
+static void print_input( char *name, int threads, metrics_t *m )
+{
+    static double  pct[3] = { 50.0, 99.0, 99.99 };
+    int64_t        value[3] = { 0 };
+
+    if ( m->counter ) {
+        hdr_percentiles( &m->hist, pct, value, 3 );
+    }
+    printf("# %-24s %3d %10ld %8.3f %8.3f %8.3f %9.3f %9.3f %8ld\n", name, threads, (long)m->counter,
+           m->counter ? m->sum_ns / 1000.0 / m->counter : 0.0,
+           value[0] / 1000.0, value[1] / 1000.0, value[2] / 1000.0, m->hist.max / 1000.0,
+           (long)m->missed );
+}
+
+
+static void print_total( int count, int threads, int64_t elapsed_ns )
+{
+    static double  pct[4] = { 50.0, 99.0, 99.9, 99.99 };
+    int64_t        value[4];
+    metrics_t     *m = total;
+
+    printf("# Total (%d inputs, %d threads, merged in %.3f ms):\n", count, threads, elapsed_ns / 1e6 );
+    if ( !m->counter ) {
+        printf("# rt   counter  = 0\n#\n");
+        return;
+    }
+    hdr_percentiles( &m->hist, pct, value, 4 );
+    printf("# rt   counter  = %ld\n",     (long)m->counter );
+    if ( period_ns > 0 ) {
+        printf("# rt   period   = %-20.3f\n", period_ns / 1000000.0 );
+    }
+    printf("# max  latency  = %-20.3f (%s)\n", m->hist.max / 1000000.0, label(worst) );
+    printf("# awg  latency  = %-20.3f\n", (double)m->sum_ns / m->counter / 1000000.0 );
+    printf("# missed period = %ld\n",     (long)m->missed );
+    printf("# overrun burst = %ld\n",     (long)m->burst.total );
+    printf("# p50   latency = %-20.3f\n", value[0] / 1000000.0 );
+    printf("# p99   latency = %-20.3f\n", value[1] / 1000000.0 );
+    printf("# p999  latency = %-20.3f\n", value[2] / 1000000.0 );
+    printf("# p9999 latency = %-20.3f\n", value[3] / 1000000.0 );
+    printf("# hist.overflow = %ld\n",     (long)m->hist.overflow );
+    printf("# hist.underflow = %ld\n",    (long)m->hist.underflow );
+    printf("# page faults   = %ld minor, %ld major\n", (long)m->minflt, (long)m->majflt );
+    printf("# invol. switch = %ld\n",     (long)m->nivcsw );
+    printf("#\n");
+}
+
+
+// Total as dump file with one thread (layout of hrtimer shared memory)
+
+static int write_total( char *path )
+{
+    shm_metrics_t  *out = calloc( 1, SHM_METRICS_SIZE(1) );
+    int             status;
+
+    if ( !out ) {
+        printf("ERROR: Out of memory\n");
+        return -1;
+    }
+    out->magic              = SHM_MAGIC;
+    out->nthreads           = 1;
+    out->size               = sizeof(thread_metrics_t);
+    out->thread[0].cpu      = -1;
+    out->thread[0].period_ns = (period_ns > 0) ? period_ns : 0;
+    out->thread[0].perf_mask = perf_mask;
+    strcpy( out->thread[0].backend, "hragg" );
+    memcpy( &out->thread[0].bank[0], total, sizeof(metrics_t) );
+    status = dump_metrics( out, path );
+    free( out );
+    return status;
+}
+
+
+// One pass over all inputs. Return count of inputs with metrics.
+
+static int aggregate( int argc, char *argv[], char *out )
+{
+    int64_t  start_ns = clock_ns( CLOCK_MONOTONIC );
+    int      count = 0, threads = 0;
+
+    find_inputs( argc, argv );
+    memset( total, 0, sizeof(metrics_t) );
+    worst_ns  = 0;
+    worst     = "";
+    period_ns = 0;
+    perf_mask = 0;
+    if ( !quiet ) {
+        printf("# input                    thr    samples  avg[us]  p50[us]  p99[us] p9999[us]"
+               "   max[us]   missed\n");
+    }
+    for ( int ix = 0; ix < ninputs; ix++ ) {
+        int  n;
+
+        if ( quiet ) {
+            n = read_input( &inputs[ix], total );
+        }
+        else {
+            memset( part, 0, sizeof(metrics_t) );
+            n = read_input( &inputs[ix], part );
+            if ( n ) {
+                print_input( label(inputs[ix].path), n, part );
+                merge_metrics( total, part );
+            }
+        }
+        count   += !!n;
+        threads += n;
+    }
+    if ( !quiet ) {
+        printf("#\n");
+    }
+    print_total( count, threads, clock_ns(CLOCK_MONOTONIC) - start_ns );
+    if ( out && count && write_total(out) ) {
+        return -1;
+    }
+    fflush( stdout );
+    return count;
+}
+
+
+static void usage( void )
+{
+    printf("Usage: hragg [-q] [-o file] [-i sec] [input ...]\n");
+    printf("  input    shared memory name (%s/name), dump file (hrtimer -d) or directory\n", SHM_DIR);
+    printf("           of them (default: all hrtimer segments in %s)\n", SHM_DIR);
+    printf("  -q       print total only\n");
+    printf("  -o file  write total as dump file (input of next hragg level)\n");
+    printf("  -i sec   repeat every sec seconds\n");
+}
+
+
+int main( int argc, char *argv[] )
+{
+    char  *out         = NULL;
+    int    interval_ms = 0;
+    int    opt, count;
+
+    while ( (opt = getopt(argc, argv, "qo:i:h")) != -1 ) {
+        switch ( opt ) {
+            case 'q':  quiet = 1;  break;
+            case 'o':  out = optarg;  break;
+            case 'i':  interval_ms = (int)(1000 * atof( optarg ));
+                       if ( interval_ms <= 0 ) {
+                           printf("ERROR: Interval must be > 0\n");
+                           exit( -1 );
+                       }
+                       break;
+            default:   usage();  exit( -1 );
+        }
+    }
+    snap  = calloc( 1, sizeof(metrics_t) );
+    part  = calloc( 1, sizeof(metrics_t) );
+    total = calloc( 1, sizeof(metrics_t) );
+    if ( !snap || !part || !total ) {
+        printf("ERROR: Out of memory\n");
+        exit( -1 );
+    }
+    do {
+        count = aggregate( argc - optind, argv + optind, out );
+        if ( interval_ms ) {
+            usleep( 1000 * interval_ms );
+        }
+    } while ( interval_ms );
+
+    if ( !count ) {
+        printf("ERROR: No hrtimer metrics found\n");
+    }
+    return (count > 0) ? 0 : -1;
+}
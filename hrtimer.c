@@ -12,6 +12,8 @@
 //
 //      /usr/lib/rtkit/rtkit-daemon
 
+#define _GNU_SOURCE              // pthread_attr_setaffinity_np(), CPU_SET()
+
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -21,18 +23,58 @@
 #include <unistd.h>              // getpid()
 #include <pthread.h>
 #include <string.h>
+#include <sched.h>               // cpu_set_t
+#include <sys/sysinfo.h>         // get_nprocs_conf()
+#include <signal.h>              // SIGXCPU
 #include "suppfunc.h"
-
-#define  SHM_METRICS    "RT_METRICS"      // Shared memory file name
-
-#define  TESTtime(sec)  (((sec) * 1000000) / RT_PERIOD)
-
-metrics_t  *metrics_data;         // ToDo: Make own instance for each RT thread
-int        UART_METRICS  =  0;    // Measure metrics using serial port loop back
+#include "outlier.h"
+#include "trace.h"
+#include "tsc.h"
+#include "backend.h"
+#include "kerneltricks.h"
+#include "loadgen.h"
+#include "export.h"
+#include "ftrace.h"
+#include "uart.h"
+#include "ipc.h"
+#include "perf.h"
+
+#define  SHM_METRICS    "RT_METRICS"      // Default shared memory file name
+
+
+shm_metrics_t     *shm_data;      // Shared memory: one metrics block for each RT thread
+thread_metrics_t  *metrics_data;  // Metrics of first RT thread (serial port loop back)
+int            UART_METRICS  = 0; // Measure metrics using serial port loop back
+char          *UART_DEV      = "/dev/ttyUSB0";  // Loop back: device, "pty", "socketpair"
+int            RT_THREADS    = 1; // Number of measurement threads
+int            RT_SMP        = 0; // Pin each measurement thread to own CPU
+int            RT_CPU[MAX_RT_THREADS];   // CPU of each measurement thread (-1 == not pinned)
+int            HDR_DIGITS    = 2; // Histogram significant digits
+int            TSC_TIME      = 0; // Time stamps from cycle counter
+int            SPIN_MARGIN   = 0; // Hybrid sleep margin [us], 0 == disabled, -1 == auto
+int            BUSY_TASKS    = 0; // Count of synthetic tasks (-x)
+int            BUSY_TASK[MAX_TASKS][4];  // exec, budget, period, phase [us]
+char          *TRACE_FILE    = 0; // Per-sample binary trace file (NULL == disabled)
+int            TRACE_ROTATE  = 256;  // Rotate trace file at this size [MB]
+char          *TIMER_BACKEND = "nanosleep";  // Timer backend(s), comma separated
+int            OVERRUN_POLICY = OVERRUN_CATCHUP;  // Late wake up: catchup, skip, rephase
+int            KERNEL_TUNE   = 0; // System tuning: 0 == off, 1 == on, 2 == dry run report
+char          *GOVERNOR      = "performance";  // cpufreq governor of RT CPUs with -k ("" == keep)
+char          *SYS_ROOT      = ""; // Prefix of /dev, /proc, /sys (fake tree for testing)
+int            LOAD_PHASE    = 10; // Load phase length [s], 0 == all loads on whole run
+char          *EXPORT_PATH   = 0;  // OpenMetrics Unix socket (NULL == disabled)
+ft_config_t    BREAK_TRACE   = { 0 };  // Ftrace breaktrace: tracefs, tracer, limit (0 == off)
+char          *IPC_LIST      = 0;  // IPC ping-pong primitives, comma separated (NULL == timer test)
+ipc_t          IPC_PAIR[MAX_IPC];  // Thread 2n == ping, 2n+1 == pong of pair n
+int            IPC_PAIRS     = 0;
+int            PERF_COUNTERS = 0;  // Per period perf_event_open() counters
+int            FAULT_COUNTERS = 0; // Per period getrusage() page faults, context switches
+char          *SHM_NAME      = SHM_METRICS;  // Instance: shared memory file name (-N)
 
 int RT_PRIORITY   = 90;
 int RT_PERIOD     = 2000;         // Unit:   [us]
-int RT_POLICY     = SCHED_FIFO;   // Policy: SCHED_FIFO, SCHED_RR, SCHED_OTHER
+int RT_POLICY     = SCHED_FIFO;   // Policy: SCHED_FIFO, SCHED_RR, SCHED_OTHER, SCHED_DEADLINE
+int DL_PARAM[2];                  // SCHED_DEADLINE runtime, deadline [us] (period == RT_PERIOD)
 
 //---------------------------------------------------------------------------
 //
@@ -60,25 +102,127 @@ int RT_POLICY     = SCHED_FIFO;   // Policy: SCHED_FIFO, SCHED_RR, SCHED_OTHER
 
 typedef struct
 {
-    int  thread_number;
+    int               thread_number;
+    int               cpu;                 // CPU where thread is pinned (-1 == not pinned)
+    thread_metrics_t  *metrics;  // Own metrics block in shared memory
+    outlier_ring_t     outliers; // Outlier records to logger thread
+    trace_ring_t      *trace;    // Per-sample trace ring (NULL == disabled)
+    backend_t          timer;    // Timer backend of measurement loop
+    ipc_t             *ipc;      // IPC ping-pong pair (NULL == timer test)
 } thread_args_t;
 
 
-thread_args_t    thread_args;  // ToDo: Make own instance for each RT thread
-int              shutdown;     // Write here non zero value to terminate RT thread
-uint32_t         runtime;
-struct timespec  last;
-int              fd;           // UART
-char             buf[100];
+thread_args_t    thread_args[MAX_RT_THREADS];
+int              shutdown;     // Write here non zero value to terminate RT thread(s)
+int64_t          runtime_ns;   // Run time, 0 == run for ever
+uart_t           uart;         // Serial port loop back
+static __thread volatile int  dl_overruns;   // SCHED_DEADLINE: SIGXCPU count of this thread
 
 
-void periodic_application_code( void )
+void periodic_application_code( void *ctx )
 {
-    *buf = 0xfe;   // LS bit first out
-
     if ( UART_METRICS ) {
-        write( fd, buf, 1 );
+        uart_send( &uart, tsc_ns() );
+    }
+}
+
+
+// Synthetic periodic task: busy wait given time
+
+void busy_task( void *ctx )
+{
+    int64_t  end = tsc_ns() + *(int64_t *)ctx;
+
+    while ( tsc_ns() < end ) {
+        ;
+    }
+}
+
+
+// Queue outlier record for logger thread (RT thread never calls printf)
+
+static void report_outlier( thread_args_t *ta, sample_t *sample )
+{
+    outlier_t  rec;
+
+    rec.counter    = ta->metrics->bank[ta->metrics->active].counter;
+    rec.cpu        = ta->cpu;
+    rec.latency_ns = sample->latency_ns;
+    rec.time_ns    = sample->now_ns;
+    rec.faults     = sample->minflt + sample->majflt;
+    rec.nivcsw     = sample->nivcsw;
+    memcpy( rec.perf, sample->perf, sizeof(rec.perf) );
+    outlier_push( &ta->outliers, &rec );
+}
+
+
+// Per period counters of RT thread: page faults and context switches
+// (getrusage) with -f, perf counters with -P (none when perf is not
+// available). Both are opt-in: each costs a syscall every period.
+
+static void open_counters( thread_args_t *ta, struct rusage *ru, perf_t *perf )
+{
+    if ( FAULT_COUNTERS ) {
+        getrusage( RUSAGE_THREAD, ru );
+    }
+    if ( PERF_COUNTERS ) {
+        ta->metrics->perf_mask = perf_open( perf );
+        if ( !perf->mask ) {
+            printf("WARNING: Thread %d: no perf counters\n", ta->thread_number);
+        }
+    }
+}
+
+
+static void read_counters( struct rusage *ru, perf_t *perf, sample_t *sample )
+{
+    if ( FAULT_COUNTERS ) {
+        thread_rusage( ru, sample );
+    }
+    sample->perf_mask = (perf->mask && !perf_read(perf, sample->perf)) ? perf->mask : 0;
+}
+
+
+static void close_counters( perf_t *perf )
+{
+    if ( PERF_COUNTERS ) {
+        perf_close( perf );
+    }
+}
+
+
+// Hybrid sleep: auto calibrate margin from wake up latencies of plain
+// timer backend sleep. Margin covers 99 % of wake ups plus 25 %, limited
+// to half of RT period.
+
+#define  CALIBRATE_CYCLES  500
+
+static int64_t calibrate_spin_margin( backend_t *timer, int64_t *next_ns, int64_t period_ns )
+{
+    hdr_hist_t       hist;
+    int64_t          margin;
+
+    hdr_init( &hist, 1 );
+    for ( int ix = 0; (ix < CALIBRATE_CYCLES) && !shutdown; ix++ ) {
+        *next_ns += period_ns;
+        timer->ops->wait( timer, *next_ns );
+        hdr_record( &hist, tsc_ns() - *next_ns );
+    }
+    margin  = hdr_percentile( &hist, 99.0 );
+    margin += margin / 4;
+    if ( margin > period_ns / 2 ) {
+         margin = period_ns / 2;
     }
+    return margin;
+}
+
+
+// SCHED_DEADLINE runtime overrun (SCHED_FLAG_DL_OVERRUN): signal goes to
+// thread which overran
+
+static void dl_overrun_handler( int sig )
+{
+    dl_overruns++;
 }
 
 
@@ -87,113 +231,434 @@ void * threadFunc( void *arg )
     #define  OFFSET_ns   0  //  100000
 
     thread_args_t *ta = arg;
+    backend_t     *timer = &ta->timer;
+
+    sample_t         sample = { 0 };
+    int64_t          period_ns = 1000 * (int64_t)RT_PERIOD;
+    int64_t          now_ns, next_ns, wake_ns, start_ns, latency_ns;
+    int64_t          margin_ns = 1000 * (int64_t)SPIN_MARGIN;
+    uint32_t         cycles = 0;
+    int              dl = (RT_POLICY == SCHED_DEADLINE);
+    int64_t          dl_deadline_ns = ta->metrics->dl_deadline_ns;
+    int              overruns = 0;
+    struct rusage    ru;
+    perf_t           perf = { .mask = 0 };
+
+    prefault_stack();
+    open_counters( ta, &ru, &perf );
+    if ( timer->ops->init(timer) ) {
+        printf("ERROR: Thread %d: timer backend %s\n", ta->thread_number, timer->ops->name);
+        return NULL;
+    }
+    if ( dl ) {
+        // Thread sets own policy, then yields to start on own period boundary
+        if ( set_sched_deadline(ta->metrics->dl_runtime_ns, dl_deadline_ns, period_ns) ) {
+            printf("ERROR: Thread %d: SCHED_DEADLINE\n", ta->thread_number);
+            return NULL;
+        }
+        sched_yield();
+        now_ns = tsc_ns();
+    }
+    else {
+        now_ns = tsc_ns();
+        now_ns = now_ns - (now_ns % period_ns) + OFFSET_ns;
+    }
 
-    struct sched_param   param;
-
-    struct timespec  now, next, remain;
-    int              latency_us;
-    int              flags = TIMER_ABSTIME;    // 0=relative or TIMER_ABSTIME, TIMER_REALTIME
-
-    clock_gettime( CLOCK_MONOTONIC, &now );
-    now.tv_nsec = now.tv_nsec - (now.tv_nsec % (1000 * RT_PERIOD)) + OFFSET_ns;
+    next_ns = now_ns;
+    if ( margin_ns < 0 ) {
+        margin_ns = calibrate_spin_margin( timer, &next_ns, period_ns );
+    }
+    ta->metrics->spin_margin_ns = margin_ns;
+    ta->metrics->bank[ta->metrics->active].start_ns = next_ns;
 
-    metrics_data->start = now;
+    // Without tasks wake up every RT period, with tasks at next task release
+    start_ns = next_ns;
+    next_ns  = tasks_start( ta->thread_number, start_ns, period_ns, OVERRUN_POLICY );
 
-    next = now;
     while ( !shutdown )
     {
-        next = tsAddus( next, RT_PERIOD );
-
-        // Note this simple example do not handle "remain"
-        // if delay end before elapsed time (like signal etc.. case).
-        int err = clock_nanosleep( CLOCK_MONOTONIC, flags, &next, &remain );
+        wake_ns = next_ns;
+
+        if ( dl ) {
+            // SCHED_DEADLINE: sched_yield() ends job, kernel wakes thread at
+            // start of next period (late thread continues without yield)
+            now_ns = tsc_ns();
+            while ( now_ns < wake_ns - period_ns / 2 ) {
+                sched_yield();
+                now_ns = tsc_ns();
+            }
+        }
+        else {
+            // Absolute wake up time: early wake up (signal etc.) is seen as
+            // negative latency, backends retry interrupted waits themselves.
+            timer->ops->wait( timer, wake_ns - margin_ns );
+            now_ns = tsc_ns();
+        }
+        if ( margin_ns ) {
+            // Hybrid sleep: busy wait rest of period
+            int64_t  spin_start = now_ns;
 
-        clock_gettime( CLOCK_MONOTONIC, &now );
-        latency_us = tsDiffus( next, now );
-        last = next;
+            while ( now_ns < wake_ns ) {
+                now_ns = tsc_ns();
+            }
+            sample.spin_ns   = now_ns - spin_start;
+            sample.spin_miss = (spin_start >= wake_ns);
+        }
+        latency_ns = now_ns - wake_ns;
+        if ( BREAK_TRACE.limit_ns && (latency_ns > BREAK_TRACE.limit_ns) &&
+             ftrace_break(ta->thread_number, latency_ns, now_ns) ) {
+            shutdown = 1;   // Trace buffer ends at spike, stop test (cyclictest -b)
+        }
 
-        periodic_application_code();
+        next_ns = run_tasks( ta->thread_number, wake_ns, &sample.tasks );
+        if ( dl ) {
+            sample.dl_miss      = (tsc_ns() - wake_ns > dl_deadline_ns);
+            sample.dl_throttled = dl_overruns - overruns;
+            overruns           += sample.dl_throttled;
+        }
+        read_counters( &ru, &perf, &sample );
         if ( !UART_METRICS ) {
-            update_metrics( metrics_data, latency_us, now );
+            sample.latency_ns = latency_ns;
+            sample.now_ns     = now_ns;
+            sample.load       = __atomic_load_n( &load_phase, __ATOMIC_RELAXED );
+            if ( update_metrics(ta->metrics, &sample) ) {
+                report_outlier( ta, &sample );
+            }
         }
 
-        if ( runtime ) {
-            if ( metrics_data->counter >= runtime ) {
-                shutdown = 1;
+        cycles++;
+        if ( ta->trace ) {
+            trace_push( ta->trace, cycles, ta->thread_number, ta->cpu, now_ns, latency_ns );
+        }
+
+        if ( runtime_ns ) {
+            if ( now_ns - start_ns >= runtime_ns ) {
+                break;
             }
         }
     }
-    printf("Thread   (end): RT\n");
+    timer->ops->fini( timer );
+    close_counters( &perf );
+    printf("Thread   (end): RT %d\n", ta->thread_number);
     return NULL;
 }
 
 
-#include <errno.h>
-#include <fcntl.h>
-#include <string.h>
-#include <termios.h>
-#include <unistd.h>
+// IPC ping-pong: even thread == ping (wakes up each RT period, round-trip
+// latency), odd thread == pong (one-way latency). Pairs are phased evenly
+// over RT period, so hand offs of different pairs do not overlap.
 
-void * threadUartRx( char *tty_dev )
+void * threadIpc( void *arg )
 {
-    #define TTY_DEV  "/dev/ttyUSB0"
-//  #define TTY_DEV  "/dev/ttyS5"
+    thread_args_t *ta    = arg;
+    ipc_t         *c     = ta->ipc;
+    backend_t     *timer = &ta->timer;
+    int            pong  = ta->thread_number & 1;
+    int64_t        period_ns = 1000 * (int64_t)RT_PERIOD;
+    int64_t        now_ns, next_ns, start_ns, latency_ns;
+    sample_t       sample = { 0 };
+    uint32_t       cycles = 0;
+    struct rusage  ru;
+    perf_t         perf = { .mask = 0 };
+
+    prefault_stack();
+    open_counters( ta, &ru, &perf );
+    if ( c->ops->attach(c, pong ? IPC_PING : IPC_PONG) || (!pong && timer->ops->init(timer)) ) {
+        printf("ERROR: Thread %d: IPC %s\n", ta->thread_number, c->ops->name);
+        shutdown = 1;
+        __atomic_store_n( &c->stop, 1, __ATOMIC_RELEASE );
+        c->ops->post( c, IPC_PING );
+        return NULL;
+    }
+    __atomic_add_fetch( &c->ready, 1, __ATOMIC_RELEASE );
+    ta->metrics->bank[ta->metrics->active].start_ns = tsc_ns();
+
+    while ( pong ) {
+        c->ops->wait( c, IPC_PING );
+        now_ns = tsc_ns();
+        if ( __atomic_load_n(&c->stop, __ATOMIC_ACQUIRE) ) {
+            close_counters( &perf );
+            printf("Thread   (end): RT %d\n", ta->thread_number);
+            return NULL;
+        }
+        latency_ns = now_ns - __atomic_load_n( &c->sent_ns, __ATOMIC_RELAXED );
+        c->ops->post( c, IPC_PONG );
+
+        read_counters( &ru, &perf, &sample );
+        sample.latency_ns = latency_ns;
+        sample.now_ns     = now_ns;
+        sample.load       = __atomic_load_n( &load_phase, __ATOMIC_RELAXED );
+        if ( update_metrics(ta->metrics, &sample) ) {
+            report_outlier( ta, &sample );
+        }
+    }
 
-    fd = open( TTY_DEV, O_RDWR | O_NOCTTY | O_SYNC );
-//  fd = open( TTY_DEV, O_RDWR | O_NOCTTY | O_NDELAY );
+    // Ping: start when pong thread waits
+    while ( (__atomic_load_n(&c->ready, __ATOMIC_ACQUIRE) < 2) && !shutdown ) {
+        usleep( 1000 );
+    }
+    now_ns   = tsc_ns();
+    start_ns = now_ns - (now_ns % period_ns) + period_ns +
+               (ta->thread_number / 2) * period_ns / IPC_PAIRS;
+    next_ns  = start_ns;
 
-    #if 1
-    if ( set_interface_attribs(fd, B115200, 0) )
-//  if ( InitCOM(fd, B115200, 0) )
+    while ( !shutdown )
     {
-        exit -1;
+        timer->ops->wait( timer, next_ns );
+        now_ns = tsc_ns();
+        __atomic_store_n( &c->sent_ns, now_ns, __ATOMIC_RELEASE );
+        c->ops->post( c, IPC_PING );
+        c->ops->wait( c, IPC_PONG );
+        latency_ns = tsc_ns() - now_ns;
+
+        if ( BREAK_TRACE.limit_ns && (latency_ns > BREAK_TRACE.limit_ns) &&
+             ftrace_break(ta->thread_number, latency_ns, now_ns) ) {
+            shutdown = 1;
+        }
+        read_counters( &ru, &perf, &sample );
+        sample.latency_ns = latency_ns;
+        sample.now_ns     = now_ns;
+        sample.load       = __atomic_load_n( &load_phase, __ATOMIC_RELAXED );
+        if ( update_metrics(ta->metrics, &sample) ) {
+            report_outlier( ta, &sample );
+        }
+        cycles++;
+        if ( ta->trace ) {
+            trace_push( ta->trace, cycles, ta->thread_number, ta->cpu, now_ns, latency_ns );
+        }
+
+        // Late: skip missed releases, keep phase
+        next_ns += period_ns;
+        if ( next_ns <= now_ns ) {
+            next_ns += ((now_ns - next_ns) / period_ns + 1) * period_ns;
+        }
+        if ( runtime_ns && (now_ns - start_ns >= runtime_ns) ) {
+            break;
+        }
     }
-    set_blocking (fd, 1);
-    #endif
+    __atomic_store_n( &c->stop, 1, __ATOMIC_RELEASE );
+    c->ops->post( c, IPC_PING );
+    timer->ops->fini( timer );
+    close_counters( &perf );
+    printf("Thread   (end): RT %d\n", ta->thread_number);
+    return NULL;
+}
+
 
-    char buffer[1000];
+// Serial port loop back receive thread: frames sent by "uart_tx" task of
+// RT thread, latency == receive time - send time of same frame
 
-    read( fd, buffer, sizeof(buffer) );   // flush buffer
+void * threadUartRx( void *arg )
+{
+    int64_t         latency_ns[UART_INFLIGHT];
+    int64_t         now_ns;
+    struct rusage   ru;
 
+    prefault_stack();
+    if ( FAULT_COUNTERS ) {
+        getrusage( RUSAGE_THREAD, &ru );
+    }
     while ( !shutdown )
     {
-        struct timespec  now;
-        int              latency_us;
+        sample_t  sample = { 0 };
+        int       n      = uart_recv( &uart, 100, latency_ns, &now_ns, UART_INFLIGHT );
 
-        read( fd, buffer, 1 );
+        if ( n && FAULT_COUNTERS ) {
+            thread_rusage( &ru, &sample );     // Whole batch: first sample
+        }
+        for ( int ix = 0; ix < n; ix++ ) {
+            if ( BREAK_TRACE.limit_ns && (latency_ns[ix] > BREAK_TRACE.limit_ns) &&
+                 ftrace_break(0, latency_ns[ix], now_ns) ) {
+                shutdown = 1;
+            }
+            sample.latency_ns = latency_ns[ix];
+            sample.now_ns     = now_ns;
+            sample.load       = __atomic_load_n( &load_phase, __ATOMIC_RELAXED );
+            if ( update_metrics(metrics_data, &sample) ) {
+                report_outlier( &thread_args[0], &sample );
+            }
+            sample.minflt = sample.majflt = sample.nivcsw = 0;
+        }
+    }
+    printf("Thread   (end): UART\n");
+    return NULL;
+}
 
-        clock_gettime( CLOCK_MONOTONIC, &now );
-        latency_us = tsDiffus( last, now );
 
-        if ( UART_METRICS ) {
-            update_metrics( metrics_data, latency_us, now );
+// Low priority thread: drain outlier rings of RT threads and print records
+
+static void drain_outliers( uint32_t *dropped )
+{
+    #define SPACE 0x20
+
+    int64_t    period_ns = 1000 * (int64_t)RT_PERIOD;
+    outlier_t  rec;
+
+    for ( int th = 0; th < RT_THREADS; th++ ) {
+        outlier_ring_t  *r = &thread_args[th].outliers;
+        uint32_t         d = __atomic_load_n( &r->dropped, __ATOMIC_RELAXED );
+
+        while ( outlier_pop(r, &rec) ) {
+            int  latency_us = rec.latency_ns / 1000;
+
+//          printf("%ld/%d\n", (long)rec.counter, latency_us );
+            printf("%8ld /%2d.%03d %c cpu%d", (long)rec.counter, latency_us / 1000, latency_us % 1000,
+                   (rec.latency_ns > period_ns) ? '*' : SPACE, rec.cpu );
+            if ( rec.faults || rec.nivcsw ) {
+                printf(" faults %d ivcsw %d", rec.faults, rec.nivcsw );
+            }
+            for ( int ev = 0; ev < PERF_EVENTS; ev++ ) {
+                if ( rec.perf[ev] ) {
+                    printf(" %s %d", perf_name(ev), rec.perf[ev] );
+                }
+            }
+            printf("\n");
+        }
+        if ( d != dropped[th] ) {
+            printf("WARNING: thread %d dropped %u outlier records\n", th, d - dropped[th]);
+            dropped[th] = d;
         }
     }
-    printf("Thread   (end): UART\n");
+    fflush( stdout );
+}
+
+
+// Low priority thread: print outliers, check cycle counter drift once per second
+
+void * threadLogger( void *arg )
+{
+    uint32_t  dropped[MAX_RT_THREADS] = { 0 };
+    int       loops = 0;
+
+    while ( !shutdown ) {
+        drain_outliers( dropped );
+        usleep( 10000 );
+
+        if ( TSC_TIME && (++loops % 100 == 0) ) {
+            int64_t  drift = tsc_check_drift();
+
+            drift = (drift < 0) ? -drift : drift;
+            if ( drift > shm_data->drift_ns ) {
+                shm_data->drift_ns = drift;
+            }
+            shm_data->clock_hz = tsc_calib[tsc_active].hz;
+        }
+    }
+    drain_outliers( dropped );
     return NULL;
 }
 
 
-int start_RT_thread( int rt_policy, int rt_priority, void *thread_func, void *arg )
+// Low priority thread: flush per-sample trace rings to trace file
+
+void * threadTrace( void *arg )
+{
+    while ( !shutdown ) {
+        if ( trace_flush() < 0 ) {
+            break;
+        }
+        usleep( 100000 );
+    }
+    return NULL;
+}
+
+
+// Low priority thread: serve OpenMetrics on Unix socket ("arg" == socket)
+
+void * threadExport( void *arg )
+{
+    int  fd = *(int *)arg;
+
+    while ( !shutdown ) {
+        export_poll( fd, shm_data, 200 );
+    }
+    return NULL;
+}
+
+
+// SCHED_DEADLINE can not be set with thread attributes: thread is created
+// as SCHED_OTHER with affinity of all CPUs (kernel refuses SCHED_DEADLINE
+// for thread pinned to subset of root domain, and with -k main thread has
+// only housekeeping CPUs) and thread function calls set_sched_deadline()
+// itself.
+
+#define  THREAD_STACK  (512 * 1024)
+
+int start_RT_thread( pthread_t *threadId, int rt_policy, int rt_priority, int cpu,
+                     void *thread_func, void *arg )
 {
     struct sched_param  parm;
     pthread_attr_t      attr;
 
     pthread_attr_init( &attr );
+    if ( rt_policy == SCHED_DEADLINE ) {
+        cpu_set_t  all;
+
+        CPU_ZERO( &all );
+        for ( int ix = 0; ix < get_nprocs_conf(); ix++ ) {
+            CPU_SET( ix, &all );
+        }
+        pthread_attr_setaffinity_np( &attr, sizeof(all), &all );
+        rt_policy   = SCHED_OTHER;
+        rt_priority = 0;
+        cpu         = -1;
+    }
     pthread_attr_setinheritsched( &attr, PTHREAD_EXPLICIT_SCHED );
     pthread_attr_setschedpolicy(  &attr, rt_policy );
     parm.sched_priority = rt_priority;
     pthread_attr_setschedparam( &attr, &parm );
+    // mlockall(MCL_FUTURE) locks and populates whole stack at create
+    pthread_attr_setstacksize( &attr, THREAD_STACK );
 
-    pthread_t  threadId;
-    int        err;
+    if ( cpu >= 0 ) {
+        cpu_set_t  mask;
 
-    err = pthread_create( &threadId, &attr, thread_func, arg );
+        CPU_ZERO( &mask );
+        CPU_SET( cpu, &mask );
+        pthread_attr_setaffinity_np( &attr, sizeof(mask), &mask );
+    }
+
+    int  err = pthread_create( threadId, &attr, thread_func, arg );
+    pthread_attr_destroy( &attr );
     if ( err ) {
          printf("ERROR to create thread\n");
          return -1;
     }
-    return threadId;
+    return 0;
+}
+
+
+// Return count of CPUs allowed for this process
+
+int count_cpus( void )
+{
+    cpu_set_t  mask;
+
+    if ( sched_getaffinity(0, sizeof(mask), &mask) ) {
+        return 1;
+    }
+    return CPU_COUNT( &mask );
+}
+
+
+// Return "n"th CPU (modulo count of CPUs) allowed for this process
+
+int get_cpu( int n )
+{
+    cpu_set_t  mask;
+    int        count;
+
+    if ( sched_getaffinity(0, sizeof(mask), &mask) ) {
+        return -1;
+    }
+    count = CPU_COUNT( &mask );
+    n     = n % count;
+    for ( int cpu = 0; cpu < CPU_SETSIZE; cpu++ ) {
+        if ( CPU_ISSET(cpu, &mask) && (n-- == 0) ) {
+            return cpu;
+        }
+    }
+    return -1;
 }
 
 
@@ -204,49 +669,313 @@ int run_RT_threads( int seconds )
     sprintf(secs, "%d", seconds);
     printf("RT PERIOD (us): %d\n", RT_PERIOD);
     printf("Run time (sec): %s\n", seconds ? secs : "...");
+    printf("RT threads    : %d\n", RT_THREADS);
+    if ( SPIN_MARGIN ) {
+        printf("Spin margin   : %s\n", (SPIN_MARGIN < 0) ? "auto" : "fixed");
+    }
+    printf("Timer backend : %s\n", TIMER_BACKEND);
+    printf("Overrun policy: %s\n", overrun_name(OVERRUN_POLICY));
+    if ( RT_POLICY == SCHED_DEADLINE ) {
+        if ( !DL_PARAM[1] ) {
+            DL_PARAM[1] = RT_PERIOD;
+        }
+        if ( (DL_PARAM[0] <= 0) || (DL_PARAM[0] > DL_PARAM[1]) || (DL_PARAM[1] > RT_PERIOD) ) {
+            printf("ERROR: SCHED_DEADLINE needs 0 < runtime <= deadline <= period\n");
+            return -1;
+        }
+        printf("Policy        : SCHED_DEADLINE runtime %d us, deadline %d us\n", DL_PARAM[0], DL_PARAM[1]);
+        signal( SIGXCPU, dl_overrun_handler );
+    }
 
-    runtime = TESTtime( seconds );
-    metrics_data->reset = 1;
+    // Backends assigned round robin to RT threads
+    backend_ops_t  *backend[MAX_RT_THREADS];
+    char            names[256] = { 0 };
+    int             nbackends = 0;
+
+    strncpy( names, TIMER_BACKEND, sizeof(names) - 1 );
+    for ( char *name = strtok(names, ","); name; name = strtok(NULL, ",") ) {
+        backend[nbackends] = backend_find( name );
+        if ( !backend[nbackends] ) {
+            printf("ERROR: Unknown timer backend %s (%s)\n", name, backend_names());
+            return -1;
+        }
+        if ( ++nbackends == MAX_RT_THREADS ) {
+            break;
+        }
+    }
+    if ( !nbackends ) {
+        printf("ERROR: No timer backend\n");
+        return -1;
+    }
 
-    lock_memory();
+    runtime_ns = seconds * NSEC_PER_SEC;
 
-    pthread_t  threadId[10];
+    if ( TSC_TIME ) {
+        if ( tsc_init() ) {
+            TSC_TIME = 0;
+        }
+        else {
+            shm_data->clock_hz = tsc_calib[0].hz;
+            printf("Time stamps   : %s %.3f MHz\n", tsc_name(), tsc_calib[0].hz / 1e6);
+        }
+    }
+    strncpy( shm_data->clock, tsc_name(), sizeof(shm_data->clock) - 1 );
+
+    trace_ring_t  *trace = NULL;
+
+    if ( TRACE_FILE ) {
+        trace = trace_open( SHM_NAME, TRACE_FILE, RT_THREADS, 1000 * (int64_t)RT_PERIOD, TRACE_ROTATE );
+        if ( !trace ) {
+            return -1;
+        }
+        printf("Trace file    : %s\n", TRACE_FILE);
+    }
+
+    static int64_t  busy_ns[MAX_TASKS];
+
+    for ( int th = 0; th < RT_THREADS; th++ ) {
+        if ( UART_METRICS ) {
+            task_register( th, "uart_tx", periodic_application_code, NULL, 0, 0, 0, 0 );
+        }
+        for ( int ix = 0; ix < BUSY_TASKS; ix++ ) {
+            int  *bt = BUSY_TASK[ix];
+            char  name[TASK_NAME_LEN];
+
+            busy_ns[ix] = 1000 * (int64_t)bt[0];
+            snprintf( name, sizeof(name), "busy%d", ix );
+            task_register( th, name, busy_task, &busy_ns[ix], 1000 * (int64_t)bt[2],
+                           1000 * (int64_t)bt[3], 1000 * (int64_t)bt[1], 0 );
+        }
+    }
+
+    for ( int th = 0; th < RT_THREADS; th++ ) {
+        thread_args_t  *ta = &thread_args[th];
+
+        ta->thread_number  = th;
+        ta->cpu            = RT_CPU[th];
+        ta->metrics        = &shm_data->thread[th];
+        ta->metrics->cpu   = ta->cpu;
+        ta->metrics->period_ns = 1000 * (int64_t)RT_PERIOD;
+        ta->metrics->ntasks    = task_config( th, ta->metrics->task );
+        ta->metrics->overrun   = OVERRUN_POLICY;
+        if ( RT_POLICY == SCHED_DEADLINE ) {
+            ta->metrics->dl_runtime_ns  = 1000 * (int64_t)DL_PARAM[0];
+            ta->metrics->dl_deadline_ns = 1000 * (int64_t)DL_PARAM[1];
+        }
+        ta->trace          = trace ? &trace[th] : NULL;
+        ta->timer.ops      = backend[(IPC_PAIRS ? th / 2 : th) % nbackends];
+        strncpy( ta->metrics->backend, ta->timer.ops->name, sizeof(ta->metrics->backend) - 1 );
+        if ( IPC_PAIRS ) {
+            ta->ipc = &IPC_PAIR[th / 2];
+            snprintf( ta->metrics->ipc, sizeof(ta->metrics->ipc), "%s %s %s CPU", ta->ipc->ops->name,
+                      (th & 1) ? "one-way" : "round-trip", ta->ipc->cross ? "cross" : "same" );
+        }
+    }
+    for ( int ix = 0; ix < IPC_PAIRS; ix++ ) {
+        if ( IPC_PAIR[ix].ops->init(&IPC_PAIR[ix]) ) {
+            return -1;
+        }
+    }
+    if ( IPC_PAIRS ) {
+        printf("IPC pairs     : %d (%s)\n", IPC_PAIRS, IPC_LIST);
+    }
+
+    // Outlier rings (trace rings and metrics are prefaulted by shmOpen())
+    prefault( thread_args, sizeof(thread_args) );
+
+    if ( BREAK_TRACE.limit_ns && ftrace_init(&BREAK_TRACE) ) {
+        return -1;
+    }
+
+    pthread_t  threadId[MAX_RT_THREADS];
+    pthread_t  uartId, loggerId, traceId, phaseId, exportId;
+    int        export_fd = -1;
+    pthread_t  loadId[MAX_LOADS];
     int        err = 0;
 
-    if ( UART_METRICS ) {
-        threadId[1] = start_RT_thread( RT_POLICY, RT_PRIORITY-1, &threadUartRx, NULL );
-        usleep( 100000 );   // Give time to flush serial port buffer
+    if ( start_RT_thread( &loggerId, SCHED_OTHER, 0, -1, &threadLogger, NULL ) ) {
+        return -1;
     }
-    threadId[0] = start_RT_thread( RT_POLICY, RT_PRIORITY-0, &threadFunc,  &thread_args );  thread_args.thread_number++;
 
-    pthread_join( threadId[0], NULL );
+    if ( trace ) {
+        if ( start_RT_thread( &traceId, SCHED_OTHER, 0, -1, &threadTrace, NULL ) ) {
+            return -1;
+        }
+    }
+    if ( EXPORT_PATH ) {
+        export_fd = export_open( EXPORT_PATH );
+        if ( (export_fd < 0) ||
+             start_RT_thread( &exportId, SCHED_OTHER, 0, -1, &threadExport, &export_fd ) ) {
+            return -1;
+        }
+        printf("OpenMetrics   : %s\n", EXPORT_PATH);
+    }
+    for ( int ix = 0; ix < nloads; ix++ ) {
+        if ( start_RT_thread( &loadId[ix], SCHED_OTHER, 0, loads[ix].cpu, &threadLoad, &loads[ix] ) ) {
+            return -1;
+        }
+    }
+    if ( nloads ) {
+        printf("Load threads  : %d, phase %d s\n", nloads, LOAD_PHASE);
+        if ( start_RT_thread( &phaseId, SCHED_OTHER, 0, -1, &threadLoadPhase, &LOAD_PHASE ) ) {
+            return -1;
+        }
+    }
     if ( UART_METRICS ) {
-        pthread_cancel( threadId[0] );
+        if ( uart_open(&uart, UART_DEV) ||
+             start_RT_thread( &uartId, (RT_POLICY == SCHED_DEADLINE) ? SCHED_FIFO : RT_POLICY,
+                              RT_PRIORITY-1, -1, &threadUartRx, NULL ) ) {
+            return -1;
+        }
+        printf("Serial loop   : %s, %d frames in flight\n", UART_DEV, UART_INFLIGHT);
     }
+    for ( int th = 0; th < RT_THREADS; th++ ) {
+        thread_args_t  *ta = &thread_args[th];
 
-#if 0
-//  threadId[1] = start_RT_thread( RT_POLICY, RT_PRIORITY-1, &threadFunc,  &thread_args );  thread_args.thread_number++;
-//  threadId[2] = start_RT_thread( RT_POLICY, RT_PRIORITY-2, &threadFunc,  &thread_args );  thread_args.thread_number++;
+        // IPC: pong preempts ping at once on same CPU
+        int  prio = (ta->ipc && !(th & 1)) ? RT_PRIORITY - 1 : RT_PRIORITY;
 
-    for ( int i = 0; i < 10; i++ ) {
-        err |= pthread_join( threadId[i], NULL );
+        if ( start_RT_thread( &threadId[th], RT_POLICY, prio, ta->cpu,
+                              ta->ipc ? &threadIpc : &threadFunc, ta ) ) {
+            shutdown = 1;
+            RT_THREADS = th;
+            break;
+        }
+    }
+
+    for ( int th = 0; th < RT_THREADS; th++ ) {
+        err |= pthread_join( threadId[th], NULL );
+    }
+    shutdown = 1;
+
+    if ( UART_METRICS ) {
+        pthread_join( uartId, NULL );
+        printf("Serial loop   : tx %u, rx %u, lost %u, window full %u, write failed %u, "
+               "resync %u bytes\n", uart.tx, uart.rx, uart.lost, uart.tx_stall,
+               uart.tx_drop, uart.resync);
+        uart_close( &uart );
+    }
+    pthread_join( loggerId, NULL );
+    if ( EXPORT_PATH ) {
+        pthread_join( exportId, NULL );
+        export_close( export_fd, EXPORT_PATH );
+    }
+    load_stop();
+    for ( int ix = 0; ix < nloads; ix++ ) {
+        pthread_join( loadId[ix], NULL );
+    }
+    if ( nloads ) {
+        pthread_join( phaseId, NULL );
+    }
+    if ( trace ) {
+        pthread_join( traceId, NULL );
+        trace_close();
+    }
+    if ( BREAK_TRACE.limit_ns ) {
+        ftrace_fini();
+    }
+    for ( int ix = 0; ix < IPC_PAIRS; ix++ ) {
+        IPC_PAIR[ix].ops->fini( &IPC_PAIR[ix] );
     }
 
     if ( err ) {
          printf("ERROR to join thread\n");
          return -1;
     }
-#endif
-
     return 0;
 }
 
 //---------------------------------------------------------------------------
 
+// Parse comma separated integers, empty field == 0
+
+static void parse_ints( char *arg, int *value, int count )
+{
+    for ( int ix = 0; ix < count; ix++ ) {
+        value[ix] = atoi( arg );
+        arg = strchr( arg, ',' );
+        if ( !arg ) {
+            break;
+        }
+        arg++;
+    }
+}
+
+
+static void usage( void )
+{
+    printf("Usage: hrtimer [options] [seconds]\n");
+    printf("  seconds  run time (default: run for ever)\n");
+    printf("  -S       SMP: one measurement thread pinned on each CPU\n");
+    printf("  -t N     N measurement threads pinned round robin on CPUs\n");
+    printf("  -H N     histogram significant digits 1...%d (default 2), 3 needs build with\n", HDR_MAX_DIGITS);
+    printf("           make HDR_MAX_DIGITS=3 (histograms 184 KB instead of 26 KB)\n");
+    printf("  -y us    hybrid sleep: sleep until margin before deadline, then busy wait\n");
+    printf("           (\"auto\" == calibrate margin from wake up latencies)\n");
+    printf("  -c       time stamps from cycle counter (rdtsc, cntvct_el0)\n");
+    printf("  -x us[,budget_us[,period_us[,phase_us]]]\n");
+    printf("           synthetic periodic task: busy wait (period 0 == RT period),\n");
+    printf("           repeat -x for multi-rate cyclic executive (max %d tasks)\n", MAX_TASKS);
+    printf("  -B name[,name...]\n");
+    printf("           timer backend(s) assigned round robin to measurement threads:\n");
+    printf("           %s (default nanosleep)\n", backend_names());
+    printf("  -D runtime_us[,deadline_us]\n");
+    printf("           SCHED_DEADLINE (period == RT period, deadline default == period),\n");
+    printf("           jobs end with sched_yield(), threads are not pinned\n");
+    printf("  -O name  overrun policy when next release is already due:\n");
+    printf("           catchup (run missed releases back to back, default),\n");
+    printf("           skip (drop missed releases, keep phase), rephase (restart from now)\n");
+    printf("  -T file  record every sample to binary trace file (decode: hrtrace)\n");
+    printf("  -z MB    rotate trace file at this size (default 256, 0 == never)\n");
+    printf("  -b us[,tracer]\n");
+    printf("           breaktrace: stop ftrace and test when latency > us, trace buffer\n");
+    printf("           ends with events before spike (tracer default nop + sched/irq/timer events)\n");
+    printf("  -F dir   tracefs directory (default /sys/kernel/tracing)\n");
+    printf("  -L type[,cpu[,intensity]]\n");
+    printf("           background load thread: membw, cache, syscall, fork, pagefault,\n");
+    printf("           intensity 1...100 %% busy (default 100), repeat -L for more loads\n");
+    printf("  -l sec   load phase length: idle, then each load type alone, latency split\n");
+    printf("           by phase (default 10, 0 == all loads on whole run)\n");
+    printf("  -I name[,name...]\n");
+    printf("           IPC ping-pong instead of timer test: %s,\n", ipc_names());
+    printf("           one-way and round-trip wake latency, threads on different CPUs\n");
+    printf("           and on same CPU (spin: different CPUs only, two CPUs of its own)\n");
+    printf("  -f       page faults and involuntary context switches of RT threads each\n");
+    printf("           period (getrusage, one syscall per period, 0 in statistics without -f)\n");
+    printf("  -P       perf counters of RT threads each period: context switches, migrations,\n");
+    printf("           page faults, cache misses (when PMU is there), deltas in outlier\n");
+    printf("           lines and averages per latency bucket in statistics\n");
+    printf("  -k       tune system, restore at exit: cpu_dma_latency, timer_migration,\n");
+    printf("           cpufreq governor, IRQs and non RT threads off RT CPUs\n");
+    printf("  -g name  cpufreq governor of RT CPUs with -k (default performance, \"\" == keep)\n");
+    printf("  -n       dry run: report tuning of -k and exit\n");
+    printf("  -R dir   root of /dev, /proc and /sys for tuning (default /)\n");
+    printf("  -E path  serve OpenMetrics on Unix socket while running (low priority thread)\n");
+    printf("  -e path  serve OpenMetrics of running hrtimer on Unix socket until Ctrl-C\n");
+    printf("  -s       measure serial port loop back latency (%s, TX wired to RX)\n", UART_DEV);
+    printf("  -u dev   loop back latency of device, or stand-in: pty (pseudo terminal pair),\n");
+    printf("           socketpair (AF_UNIX stream)\n");
+    printf("  -N name  instance name: shared memory /dev/shm/name (default %s),\n", SHM_METRICS);
+    printf("           with -r, -p, -w, -e and -d attach to this instance\n");
+    printf("  -d file  dump snapshot of metrics to file (input of hragg)\n");
+    printf("  -r       reset shared memory metrics\n");
+    printf("  -p       print statistics\n");
+    printf("  -w sec   watch: print statistics of each interval (count, min, avg, max,\n");
+    printf("           p50/p99/p99.9/p99.99) until Ctrl-C\n");
+}
+
+
 int main( int argc, char *argv[] )
 {
     int    status          = 0;
     int    seconds         = 0;    // Default (==0) run for ever....
+    int    reset           = 0;
+    int    print           = 0;
+    int    watch_ms        = 0;
+    char  *serve           = 0;    // Attach: serve OpenMetrics on this socket
+    char  *dump            = 0;    // Attach: dump metrics to this file
+    int    opt;
+    size_t shm_size;
 
 //  pid_t  pid             = getpid();
 //  int    currentPriority = getpriority( PRIO_PROCESS, pid );
@@ -255,44 +984,212 @@ int main( int argc, char *argv[] )
 //  setpriority( PRIO_PROCESS, pid, newPriority );
 
     check_root();
-    metrics_data = shmOpen( "", SHM_METRICS, sizeof(metrics_t) );
-    if ( !metrics_data ) {
-        printf("ERROR: Can not open shared memory\n");
-        exit( -1 );
-    }
-
-    if ( argc > 1 ) {
 
-        int  sec = atoi( argv[1] );
+    while ( (opt = getopt(argc, argv, "St:H:y:cx:B:D:O:L:l:T:z:b:F:I:Pfkng:R:E:e:su:N:d:rpw:h")) != -1 ) {
+        switch ( opt ) {
+            case 'S':  RT_SMP = 1;  RT_THREADS = count_cpus();  break;
+            case 't':  RT_SMP = 1;  RT_THREADS = atoi( optarg );  break;
+            case 'H':  HDR_DIGITS = atoi( optarg );  break;
+            case 'y':  SPIN_MARGIN = strcmp(optarg, "auto") ? atoi( optarg ) : -1;  break;
+            case 'c':  TSC_TIME = 1;  break;
+            case 'x':  if ( BUSY_TASKS < MAX_TASKS ) {
+                           parse_ints( optarg, BUSY_TASK[BUSY_TASKS++], 4 );
+                       }
+                       break;
+            case 'B':  TIMER_BACKEND = optarg;  break;
+            case 'D':  RT_POLICY = SCHED_DEADLINE;  parse_ints( optarg, DL_PARAM, 2 );  break;
+            case 'O':  OVERRUN_POLICY = overrun_policy( optarg );
+                       if ( OVERRUN_POLICY < 0 ) {
+                           printf("ERROR: Unknown overrun policy %s\n", optarg);
+                           exit( -1 );
+                       }
+                       break;
+            case 'L':  if ( load_parse(optarg) ) {
+                           exit( -1 );
+                       }
+                       break;
+            case 'l':  LOAD_PHASE = atoi( optarg );  break;
+            case 'T':  TRACE_FILE = optarg;  break;
+            case 'z':  TRACE_ROTATE = atoi( optarg );  break;
+            case 'b':  BREAK_TRACE.limit_ns = 1000 * (int64_t)atoi( optarg );
+                       if ( strchr(optarg, ',') ) {
+                           BREAK_TRACE.tracer = strchr( optarg, ',' ) + 1;
+                       }
+                       if ( BREAK_TRACE.limit_ns <= 0 ) {
+                           printf("ERROR: Breaktrace limit must be > 0\n");
+                           exit( -1 );
+                       }
+                       break;
+            case 'F':  BREAK_TRACE.path = optarg;  break;
+            case 'E':  EXPORT_PATH = optarg;  break;
+            case 'I':  IPC_LIST = optarg;  break;
+            case 'P':  PERF_COUNTERS = 1;  break;
+            case 'f':  FAULT_COUNTERS = 1;  break;
+            case 'e':  serve = optarg;  break;
+            case 'k':  KERNEL_TUNE = 1;  break;
+            case 'n':  KERNEL_TUNE = 2;  break;
+            case 'g':  GOVERNOR = optarg;  break;
+            case 'R':  SYS_ROOT = optarg;  break;
+            case 's':  UART_METRICS = 1;  break;
+            case 'u':  UART_METRICS = 1;  UART_DEV = optarg;  break;
+            case 'N':  SHM_NAME = optarg;  break;
+            case 'd':  dump = optarg;  break;
+            case 'r':  reset = 1;  break;
+            case 'p':  print = 1;  break;
+            case 'w':  watch_ms = (int)(1000 * atof( optarg ));
+                       if ( watch_ms <= 0 ) {
+                           printf("ERROR: Watch interval must be > 0\n");
+                           exit( -1 );
+                       }
+                       break;
+            default:   usage();  exit( -1 );
+        }
+    }
+    if ( optind < argc ) {
+        int  sec = atoi( argv[optind] );
 
         if ( sec > 0 ) {
-            seconds = sec;;
+            seconds = sec;
         }
-        else if ( !strcmp(argv[1],"-s") ) {
-            UART_METRICS = 1;
+        else {
+            printf("ERROR Unknown command line argument: %s\n", argv[optind]);
+            usage();
+            exit( -1 );
         }
-        else if ( !strcmp(argv[1],"-r") ) {
-            metrics_data->reset = 1;
-            goto done;
+    }
+    if ( !SHM_NAME[0] || strchr(SHM_NAME, '/') || (strlen(SHM_NAME) > 64) ) {
+        printf("ERROR: Instance name must be 1...64 characters without '/'\n");
+        exit( -1 );
+    }
+    if ( IPC_LIST && !(reset || print || watch_ms || serve || dump) ) {
+        if ( BUSY_TASKS || UART_METRICS || (RT_POLICY == SCHED_DEADLINE) || SPIN_MARGIN ) {
+            printf("ERROR: IPC test does not run with -x, -s, -u, -D or -y\n");
+            exit( -1 );
         }
-        else if ( !strcmp(argv[1],"-p") ) {
-            print_metrics( metrics_data );
-            goto done;
+        IPC_PAIRS = ipc_parse( IPC_LIST, IPC_PAIR, MAX_IPC, count_cpus() );
+        if ( IPC_PAIRS < 0 ) {
+            exit( -1 );
+        }
+        RT_SMP     = 1;
+        RT_THREADS = 2 * IPC_PAIRS;
+    }
+    if ( (RT_THREADS < 1) || (RT_THREADS > MAX_RT_THREADS) ) {
+        printf("ERROR: Thread count must be 1...%d\n", MAX_RT_THREADS);
+        exit( -1 );
+    }
+    if ( (HDR_DIGITS < 1) || (HDR_DIGITS > HDR_MAX_DIGITS) ) {
+        printf("ERROR: Histogram significant digits must be 1...%d (build limit HDR_MAX_DIGITS)\n", HDR_MAX_DIGITS);
+        exit( -1 );
+    }
+    if ( (RT_POLICY == SCHED_DEADLINE) && SPIN_MARGIN ) {
+        printf("NOTE: Hybrid sleep is not used with SCHED_DEADLINE\n");
+        SPIN_MARGIN = 0;
+    }
+    if ( UART_METRICS && (RT_THREADS > 1) ) {
+        printf("NOTE: Serial port loop back uses one RT thread\n");
+        RT_THREADS = 1;
+    }
+
+    if ( reset || print || watch_ms || serve || dump ) {
+        shm_data = shmAttach( "", SHM_NAME, &shm_size );
+        if ( !shm_data ) {
+            exit( -1 );
+        }
+        if ( (shm_data->magic != SHM_MAGIC)  ||
+             (shm_data->size != sizeof(thread_metrics_t))  ||
+             (shm_size < SHM_METRICS_SIZE(shm_data->nthreads)) ) {
+            printf("ERROR: Shared memory layout mismatch\n");
+            status = -1;
+        }
+        else if ( reset ) {
+            for ( int th = 0; th < shm_data->nthreads; th++ ) {
+                if ( reset_metrics(&shm_data->thread[th]) ) {
+                    printf("NOTE: Thread %d has not yet handled previous reset\n", th);
+                }
+            }
+        }
+        else if ( dump ) {
+            status = dump_metrics( shm_data, dump );
+        }
+        else if ( watch_ms ) {
+            watch_metrics( shm_data, watch_ms );
+        }
+        else if ( serve ) {
+            int  fd = export_open( serve );
+
+            if ( fd < 0 ) {
+                status = -1;
+            }
+            while ( fd >= 0 ) {
+                export_poll( fd, shm_data, 1000 );
+            }
         }
         else {
-            printf("ERROR Unknown command line argument: %s\n", argv[1]);
-            goto done;
+            print_all_metrics( shm_data );
+        }
+        goto done;
+    }
+
+    // CPUs before tuning moves this process to housekeeping CPUs.
+    // SCHED_DEADLINE threads run on all CPUs (see start_RT_thread()).
+    for ( int th = 0; th < RT_THREADS; th++ ) {
+        RT_CPU[th] = (RT_SMP && (RT_POLICY != SCHED_DEADLINE)) ? get_cpu( th ) : -1;
+        if ( IPC_PAIRS ) {
+            // Ping on first CPU of pair, pong on next (cross) or same CPU
+            RT_CPU[th] = get_cpu( IPC_PAIR[th / 2].cpu + ((th & 1) && IPC_PAIR[th / 2].cross) );
+        }
+    }
+    if ( KERNEL_TUNE ) {
+        kt_config_t  kt = { 0 };
+
+        kt.root            = SYS_ROOT;
+        kt.dry_run         = (KERNEL_TUNE == 2);
+        kt.dma_latency     = 0;
+        kt.governor        = GOVERNOR[0] ? GOVERNOR : NULL;
+        kt.timer_migration = 0;
+        CPU_ZERO( &kt.rt_cpus );
+        for ( int th = 0; th < RT_THREADS; th++ ) {
+            if ( RT_CPU[th] >= 0 ) {
+                CPU_SET( RT_CPU[th], &kt.rt_cpus );
+            }
+        }
+        if ( init_kernel_tricks(&kt) || kt.dry_run ) {
+            exit( kt.dry_run ? 0 : -1 );
         }
     }
+
+    // Lock before shared memory, rings and thread stacks are mapped, so
+    // each of them is populated when created (MCL_FUTURE)
+    lock_memory();
+
+    shm_size = SHM_METRICS_SIZE( RT_THREADS );
+    shm_data = shmOpen( "", SHM_NAME, shm_size );
+    if ( !shm_data ) {
+        printf("ERROR: Can not open shared memory\n");
+        exit( -1 );
+    }
+    memset( shm_data, 0, shm_size );
+    shm_data->magic    = SHM_MAGIC;
+    shm_data->nthreads = RT_THREADS;
+    shm_data->size     = sizeof(thread_metrics_t);
+    for ( int th = 0; th < RT_THREADS; th++ ) {
+        init_metrics( &shm_data->thread[th].bank[0], HDR_DIGITS );
+        init_metrics( &shm_data->thread[th].bank[1], HDR_DIGITS );
+        init_detail( &shm_data->thread[th].detail[0], HDR_DIGITS );
+        init_detail( &shm_data->thread[th].detail[1], HDR_DIGITS );
+        shm_data->thread[th].loads = (nloads > 0);
+    }
+    metrics_data       = &shm_data->thread[0];
+
     status = run_RT_threads( seconds );
 
 done:
-    munmap( metrics_data, sizeof(metrics_t) );
+    munmap( shm_data, shm_size );
 
     #if 0 //FALSE
     // We leave shared memory files open for other processes!
     // Close hared memory file(s): /dev/shm/....
-//  shm_unlink(SHM_METRICS);
+//  shm_unlink(SHM_NAME);
     #endif
 
     return status;
@@ -0,0 +1,161 @@
+//  gcc hrtrace.c histogram.c -O2 -o hrtrace
+//
+// Offline decoder of hrtimer per-sample trace files (hrtimer -T file)
+//
+// Usage:  hrtrace [-c] [file.1 file.2 ...] file
+//
+//      -c  print every record as CSV: thread,cpu,seq,wake_ns,latency_ns
+//
+// Without "-c" print per thread report: sample count, lost samples
+// (sequence gaps), min / avg / max and percentiles of latency.
+// Give rotated files in recording order: file.1 file.2 ... file
+//
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "histogram.h"
+#include "trace.h"
+
+#define MAX_THREADS  64
+
+typedef struct  {
+    hdr_hist_t  hist;
+    int64_t     sum_ns;
+    int64_t     first_ns, last_ns;
+    uint32_t    last_seq;
+    int64_t     lost;
+    int         cpu;
+} report_t;
+
+static report_t  report[MAX_THREADS];
+static int       csv;
+
+//---------------------------------------------------------------------------
+
+static void add_record( trace_rec_t *rec )
+{
+    report_t  *r;
+
+    if ( csv ) {
+        printf("%u,%d,%u,%ld,%d\n", rec->thread, (rec->cpu == 0xffff) ? -1 : rec->cpu,
+               rec->seq, (long)rec->wake_ns, rec->latency_ns );
+        return;
+    }
+    if ( rec->thread >= MAX_THREADS ) {
+        return;
+    }
+    r = &report[rec->thread];
+    if ( !r->hist.digits ) {
+        hdr_init( &r->hist, HDR_MAX_DIGITS );
+        r->first_ns = rec->wake_ns;
+        r->cpu      = (rec->cpu == 0xffff) ? -1 : rec->cpu;
+    }
+    else if ( rec->seq > r->last_seq + 1 ) {
+        r->lost += rec->seq - r->last_seq - 1;
+    }
+    if ( rec->wake_ns < r->first_ns ) {
+        r->first_ns = rec->wake_ns;
+    }
+    if ( rec->wake_ns > r->last_ns ) {
+        r->last_ns = rec->wake_ns;
+    }
+    r->last_seq = rec->seq;
+    r->sum_ns  += rec->latency_ns;
+    hdr_record( &r->hist, rec->latency_ns );
+}
+
+
+static int decode_file( char *name )
+{
+    trace_header_t  hdr;
+    trace_rec_t     buf[4096];
+    size_t          n;
+
+    FILE *f = fopen( name, "rb" );
+    if ( !f ) {
+        fprintf( stderr, "ERROR: Can not open %s\n", name );
+        return -1;
+    }
+    if ( (fread(&hdr, sizeof(hdr), 1, f) != 1) || (hdr.magic != TRACE_MAGIC) ||
+         (hdr.version != TRACE_VERSION) || (hdr.record_size != sizeof(trace_rec_t)) ) {
+        fprintf( stderr, "ERROR: %s is not hrtimer trace file\n", name );
+        fclose( f );
+        return -1;
+    }
+    while ( (n = fread(buf, sizeof(trace_rec_t), 4096, f)) > 0 ) {
+        for ( size_t ix = 0; ix < n; ix++ ) {
+            add_record( &buf[ix] );
+        }
+    }
+    fclose( f );
+    return 0;
+}
+
+
+static void print_report( void )
+{
+    hdr_hist_t  total;
+
+    hdr_init( &total, HDR_MAX_DIGITS );
+    printf("# thread cpu   samples   lost   min[us]   avg[us]   p50[us]   p99[us]  p999[us]   max[us]  time[s]\n");
+    for ( int th = 0; th < MAX_THREADS; th++ ) {
+        report_t  *r = &report[th];
+        int64_t    n = r->hist.total;
+
+        if ( !n ) {
+            continue;
+        }
+        printf("%8d %3d %9ld %6ld %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f %8.3f\n",
+               th, r->cpu, (long)n, (long)r->lost,
+               r->hist.min / 1000.0, (double)r->sum_ns / n / 1000.0,
+               hdr_percentile(&r->hist, 50.0) / 1000.0,
+               hdr_percentile(&r->hist, 99.0) / 1000.0,
+               hdr_percentile(&r->hist, 99.9) / 1000.0,
+               r->hist.max / 1000.0, (r->last_ns - r->first_ns) / 1e9 );
+        hdr_merge( &total, &r->hist );
+    }
+    if ( total.total ) {
+        printf("#   total     %9ld        %9.3f           %9.3f %9.3f %9.3f %9.3f\n",
+               (long)total.total, total.min / 1000.0,
+               hdr_percentile(&total, 50.0) / 1000.0,
+               hdr_percentile(&total, 99.0) / 1000.0,
+               hdr_percentile(&total, 99.9) / 1000.0,
+               total.max / 1000.0 );
+    }
+}
+
+//---------------------------------------------------------------------------
+
+int main( int argc, char *argv[] )
+{
+    int  opt;
+
+    while ( (opt = getopt(argc, argv, "c")) != -1 ) {
+        switch ( opt ) {
+            case 'c':  csv = 1;  break;
+            default:
+                printf("Usage: hrtrace [-c] [file.1 ...] file\n");
+                exit( -1 );
+        }
+    }
+    if ( optind >= argc ) {
+        printf("Usage: hrtrace [-c] [file.1 ...] file\n");
+        exit( -1 );
+    }
+    if ( csv ) {
+        printf("thread,cpu,seq,wake_ns,latency_ns\n");
+    }
+    for ( int ix = optind; ix < argc; ix++ ) {
+        if ( decode_file(argv[ix]) ) {
+            exit( -1 );
+        }
+    }
+    if ( !csv ) {
+        print_report();
+    }
+    return 0;
+}
@@ -0,0 +1,319 @@
+//
+// File:  ipc.c
+//
+// Thread wake up primitives of IPC ping-pong test (see ipc.h)
+//
+
+#define _GNU_SOURCE              // pipe2(), gettid
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <mqueue.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "ipc.h"
+
+#define IPC_SIGNAL    (SIGRTMIN + 2)
+
+//---------------------------------------------------------------------------
+
+static int none_attach( ipc_t *c, int dir )
+{
+    return 0;
+}
+
+
+static void none_fini( ipc_t *c )
+{
+}
+
+//---------------------------------------------------------------------------
+// futex: counter per direction, waiter sleeps while counter == seen
+
+static int futex_init( ipc_t *c )
+{
+    return 0;
+}
+
+
+static void futex_post( ipc_t *c, int dir )
+{
+    __atomic_add_fetch( &c->line[dir].count, 1, __ATOMIC_RELEASE );
+    syscall( SYS_futex, &c->line[dir].count, FUTEX_WAKE | FUTEX_PRIVATE_FLAG, 1, NULL, NULL, 0 );
+}
+
+
+static void futex_wait( ipc_t *c, int dir )
+{
+    ipc_line_t  *l = &c->line[dir];
+
+    while ( __atomic_load_n(&l->count, __ATOMIC_ACQUIRE) == l->seen ) {
+        syscall( SYS_futex, &l->count, FUTEX_WAIT | FUTEX_PRIVATE_FLAG, l->seen, NULL, NULL, 0 );
+    }
+    l->seen++;
+}
+
+//---------------------------------------------------------------------------
+// spin: counter per direction, waiter busy polls (never sleeps)
+
+static void spin_post( ipc_t *c, int dir )
+{
+    __atomic_add_fetch( &c->line[dir].count, 1, __ATOMIC_RELEASE );
+}
+
+
+static void spin_wait( ipc_t *c, int dir )
+{
+    ipc_line_t  *l = &c->line[dir];
+
+    while ( __atomic_load_n(&l->count, __ATOMIC_ACQUIRE) == l->seen ) {
+        ;
+    }
+    l->seen++;
+}
+
+//---------------------------------------------------------------------------
+// eventfd
+
+static int eventfd_init( ipc_t *c )
+{
+    for ( int dir = 0; dir < 2; dir++ ) {
+        c->fd[dir][0] = eventfd( 0, EFD_CLOEXEC );
+        if ( c->fd[dir][0] < 0 ) {
+            perror("eventfd");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+static void eventfd_post( ipc_t *c, int dir )
+{
+    uint64_t  one = 1;
+
+    write( c->fd[dir][0], &one, sizeof(one) );
+}
+
+
+static void eventfd_wait( ipc_t *c, int dir )
+{
+    uint64_t  count;
+
+    while ( (read(c->fd[dir][0], &count, sizeof(count)) < 0) && (errno == EINTR) ) {
+        ;
+    }
+}
+
+
+static void eventfd_fini( ipc_t *c )
+{
+    close( c->fd[0][0] );
+    close( c->fd[1][0] );
+}
+
+//---------------------------------------------------------------------------
+// pipe
+
+static int pipe_init( ipc_t *c )
+{
+    if ( pipe2(c->fd[0], O_CLOEXEC) || pipe2(c->fd[1], O_CLOEXEC) ) {
+        perror("pipe");
+        return -1;
+    }
+    return 0;
+}
+
+
+static void pipe_post( ipc_t *c, int dir )
+{
+    char  byte = 0;
+
+    write( c->fd[dir][1], &byte, 1 );
+}
+
+
+static void pipe_wait( ipc_t *c, int dir )
+{
+    char  byte;
+
+    while ( (read(c->fd[dir][0], &byte, 1) < 0) && (errno == EINTR) ) {
+        ;
+    }
+}
+
+
+static void pipe_fini( ipc_t *c )
+{
+    for ( int dir = 0; dir < 2; dir++ ) {
+        close( c->fd[dir][0] );
+        close( c->fd[dir][1] );
+    }
+}
+
+//---------------------------------------------------------------------------
+// POSIX message queue (name is unlinked at once, descriptors stay)
+
+static int mq_init( ipc_t *c )
+{
+    struct mq_attr  attr = { .mq_maxmsg = 8, .mq_msgsize = 8 };
+    char            name[64];
+
+    for ( int dir = 0; dir < 2; dir++ ) {
+        snprintf( name, sizeof(name), "/hrtimer-%d-%p-%d", (int)getpid(), (void *)c, dir );
+        c->mq[dir] = mq_open( name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600, &attr );
+        if ( c->mq[dir] == (mqd_t)-1 ) {
+            perror("mq_open");
+            return -1;
+        }
+        mq_unlink( name );
+    }
+    return 0;
+}
+
+
+static void mq_post( ipc_t *c, int dir )
+{
+    mq_send( c->mq[dir], "", 1, 0 );
+}
+
+
+static void mq_wait( ipc_t *c, int dir )
+{
+    char  msg[8];
+
+    while ( (mq_receive(c->mq[dir], msg, sizeof(msg), NULL) < 0) && (errno == EINTR) ) {
+        ;
+    }
+}
+
+
+static void mq_fini( ipc_t *c )
+{
+    mq_close( c->mq[0] );
+    mq_close( c->mq[1] );
+}
+
+//---------------------------------------------------------------------------
+// Queued RT signal to waiting thread, blocked there and taken with
+// sigwaitinfo() (no handler)
+
+static int signal_init( ipc_t *c )
+{
+    return 0;
+}
+
+
+static int signal_attach( ipc_t *c, int dir )
+{
+    sigset_t  set;
+
+    sigemptyset( &set );
+    sigaddset( &set, IPC_SIGNAL );
+    c->tid[dir] = syscall( SYS_gettid );
+    return pthread_sigmask( SIG_BLOCK, &set, NULL );
+}
+
+
+static void signal_post( ipc_t *c, int dir )
+{
+    syscall( SYS_tgkill, getpid(), c->tid[dir], IPC_SIGNAL );
+}
+
+
+static void signal_wait( ipc_t *c, int dir )
+{
+    sigset_t  set;
+
+    sigemptyset( &set );
+    sigaddset( &set, IPC_SIGNAL );
+    while ( sigwaitinfo(&set, NULL) != IPC_SIGNAL ) {
+        ;
+    }
+}
+
+//---------------------------------------------------------------------------
+
+static ipc_ops_t  ipcs[] = {
+    { "futex",   futex_init,   none_attach,   futex_post,   futex_wait,   none_fini    },
+    { "eventfd", eventfd_init, none_attach,   eventfd_post, eventfd_wait, eventfd_fini },
+    { "pipe",    pipe_init,    none_attach,   pipe_post,    pipe_wait,    pipe_fini    },
+    { "mq",      mq_init,      none_attach,   mq_post,      mq_wait,      mq_fini      },
+    { "signal",  signal_init,  signal_attach, signal_post,  signal_wait,  none_fini    },
+    { "spin",    futex_init,   none_attach,   spin_post,    spin_wait,    none_fini    },
+};
+
+#define IPCS  (sizeof(ipcs) / sizeof(ipcs[0]))
+
+
+// Parse comma separated primitives into ping-pong pairs: cross CPU pair
+// (when more than one CPU) and same CPU pair (not spin) of each. Pairs
+// share CPUs 0 and 1, each spin pair gets next two CPUs of its own.
+// Return count of pairs, -1 on error.
+
+int ipc_parse( char *list, ipc_t *pairs, int max, int cpus )
+{
+    char  names[256] = { 0 };
+    int   n = 0, shared = 0, next;
+
+    strncpy( names, list, sizeof(names) - 1 );
+    for ( char *name = strtok(names, ","); name; name = strtok(NULL, ",") ) {
+        ipc_ops_t  *ops = NULL;
+
+        for ( int ix = 0; ix < IPCS; ix++ ) {
+            if ( !strcmp(ipcs[ix].name, name) ) {
+                ops = &ipcs[ix];
+            }
+        }
+        if ( !ops ) {
+            printf("ERROR: Unknown IPC %s (%s)\n", name, ipc_names());
+            return -1;
+        }
+        for ( int cross = 1; cross >= 0; cross-- ) {
+            if ( (cross && (cpus < 2)) || (!cross && (ops->wait == spin_wait)) ) {
+                continue;              // spin waiter would starve poster on same CPU
+            }
+            if ( n == max ) {
+                printf("ERROR: Max %d IPC pairs\n", max);
+                return -1;
+            }
+            memset( &pairs[n], 0, sizeof(pairs[n]) );
+            pairs[n].ops   = ops;
+            pairs[n].cross = cross;
+            shared        |= (ops->wait != spin_wait);
+            n++;
+        }
+    }
+    if ( !n ) {
+        printf("ERROR: No IPC pairs (spin needs two CPUs)\n");
+        return -1;
+    }
+    next = shared ? 2 : 0;
+    for ( int ix = 0; ix < n; ix++ ) {
+        if ( pairs[ix].ops->wait != spin_wait ) {
+            continue;
+        }
+        if ( next + 2 > cpus ) {
+            printf("ERROR: spin pair needs two CPUs of its own (%d CPUs)\n", cpus);
+            return -1;
+        }
+        pairs[ix].cpu = next;
+        next         += 2;
+    }
+    return n;
+}
+
+
+char *ipc_names( void )
+{
+    return "futex, eventfd, pipe, mq, signal, spin";
+}
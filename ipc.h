@@ -0,0 +1,82 @@
+//
+// File:  ipc.h
+//
+// Thread wake up primitives of IPC ping-pong test (like ptsematest,
+// pmqtest and sigwaittest of rt-tests)
+//
+// Ping thread wakes up each RT period, stamps time and posts to pong
+// thread, pong thread posts back. Pong thread measures one-way latency,
+// ping thread round-trip latency. Each direction is own counting channel,
+// so post before wait is never lost:
+//
+//      futex       counter + FUTEX_WAKE / FUTEX_WAIT
+//      eventfd     write() / read() of eventfd counter
+//      pipe        write() / read() of one byte
+//      mq          mq_send() / mq_receive() of POSIX message queue
+//      signal      tgkill() / sigwaitinfo() of queued RT signal
+//      spin        counter, waiter busy polls (cross CPU only)
+//
+// Each primitive runs with threads on different CPUs (cross) and on same
+// CPU (same), pong thread has higher priority than ping thread. Pairs
+// share first two CPUs, except spin pair: its pong polls for ever at RT
+// priority and would starve other pongs, so it has two CPUs of its own.
+//
+
+#ifndef  IPC_H
+#define  IPC_H
+
+#include <stdint.h>
+#include <signal.h>
+#include <mqueue.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef CACHE_LINE
+#define CACHE_LINE    64
+#endif
+
+#define IPC_PING      0         // Direction ping -> pong
+#define IPC_PONG      1         // Direction pong -> ping
+#define MAX_IPC       32        // Ping-pong pairs
+
+typedef struct ipc_s  ipc_t;
+
+typedef struct  {
+    char   *name;
+    int   (*init)( ipc_t *c );                // Called by main thread
+    int   (*attach)( ipc_t *c, int dir );     // Called by waiter of "dir"
+    void  (*post)( ipc_t *c, int dir );
+    void  (*wait)( ipc_t *c, int dir );
+    void  (*fini)( ipc_t *c );
+} ipc_ops_t;
+
+typedef struct  {
+    uint32_t  count;            // Posts (futex, spin)
+    uint32_t  seen;             // Posts consumed by waiter
+} __attribute__((aligned(CACHE_LINE))) ipc_line_t;
+
+struct ipc_s  {
+    ipc_ops_t  *ops;
+    int         cross;          // Ping and pong on different CPUs
+    int         cpu;            // CPU index of ping (get_cpu()), pong on next (cross)
+    int         fd[2][2];       // Per direction: pipe (read, write), eventfd [0]
+    mqd_t       mq[2];
+    pid_t       tid[2];         // signal: waiting thread of direction
+    int         ready;          // Attached threads (ping starts at 2)
+    int         stop;           // Ping thread done, pong thread exits
+    int64_t     sent_ns;        // Ping time stamp
+    ipc_line_t  line[2];
+};
+
+
+int   ipc_parse( char *list, ipc_t *pairs, int max, int cpus );
+char *ipc_names( void );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IPC_H
@@ -1,4 +1,4 @@
-//  gcc hrtimer.c -O2 -o hrtimer -lrt -lpthread
+//  System tuning for RT measurement (see kerneltricks.h)
 //
 // #include <iostream>
 // #include <time.h>
@@ -7,6 +7,8 @@
 // https://stackoverflow.com/questions/6749621/how-to-create-a-high-resolution-timer-in-linux-to-measure-program-performance
 //
 
+#define _GNU_SOURCE        // sched_setaffinity(), CPU_SET()
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <time.h>
@@ -14,9 +16,11 @@
 #include <unistd.h>
 #include <pthread.h>
 #include <sched.h>
+#include <signal.h>
+#include <dirent.h>        // opendir()
+#include <stdint.h>
 
-void init_kernel_tricks( void );
-void restore_kernel_tricks( void );
+#include "kerneltricks.h"
 
 //---------------------------------------------------------------------------
 // Tricks from "cyclictest.c"
@@ -26,12 +30,11 @@ void restore_kernel_tricks( void );
 #include <fcntl.h>         // O_READONLY, etc....
 #include <errno.h>
 #include <sys/utsname.h>   // uname()
-#include <sys/mman.h>      // mlockall(), munlockall()
 
-#define KVARS		32
-#define KVARNAMELEN	32
-#define KVALUELEN		32
+#define KVARS		512
+#define KVALUELEN	320
 #define MAX_PATH		256
+#define STACK_PREFAULT	(64*1024)
 
 enum kernelversion {
 	KV_NOT_SUPPORTED,
@@ -42,21 +45,26 @@ enum kernelversion {
 };
 
 static char *procfileprefix = "/proc/sys/kernel/";
-static char *fileprefix;
+static char *root = "";
+static int   dry_run;
 
-static char functiontracer[MAX_PATH];
-static char traceroptions[MAX_PATH];
 static int  kernelversion;
-static int  lockall = 0;
 static int  laptop  = 0;
 
 static int     latency_target_fd    = -1;
 static int32_t latency_target_value =  0;
 
+static cpu_set_t  old_affinity;
+static int        affinity_set;
+
+static sigset_t         restore_signals;
+static pthread_t        restore_thread;
+static pthread_mutex_t  restore_lock = PTHREAD_MUTEX_INITIALIZER;
+
 
-/* Backup of kernel variables that we modify */
+/* Backup of kernel variables that we modify (full path) */
 static struct kvars {
-	char name[KVARNAMELEN];
+	char name[MAX_PATH];
 	char value[KVALUELEN];
 } kv[KVARS];
 
@@ -67,16 +75,6 @@ static void warn( char *txt )
 }
 
 
-//static void err_msg_n( int errorNr, char *txt, ... )
-
-static void err_msg_n( int errorNr, char *txt, int value )
-{
-    printf( txt, value );
-    perror( txt );
-    exit( -1 );
-}
-
-
 static void err_msg_2( int errorNr, char *txt )
 {
     perror( txt );
@@ -96,22 +94,28 @@ static void err_msg_2( int errorNr, char *txt )
 static void set_latency_target(void)
 {
 	struct stat s;
+	char path[MAX_PATH];
 	int err;
 
 	if (laptop) {
 		warn("not setting cpu_dma_latency to save battery power\n");
 		return;
 	}
+	snprintf(path, sizeof(path), "%s/dev/cpu_dma_latency", root);
 
 	errno = 0;
-	err = stat("/dev/cpu_dma_latency", &s);
+	err = stat(path, &s);
 	if (err == -1) {
 		err_msg_2(errno, "WARN: stat /dev/cpu_dma_latency failed");
 		return;
 	}
+	if (dry_run) {
+		printf("  %s: hold open, %dus\n", path, latency_target_value);
+		return;
+	}
 
 	errno = 0;
-	latency_target_fd = open("/dev/cpu_dma_latency", O_RDWR);
+	latency_target_fd = open(path, O_RDWR);
 	if (latency_target_fd == -1) {
 		err_msg_2(errno, "WARN: open /dev/cpu_dma_latency");
 		return;
@@ -120,8 +124,10 @@ static void set_latency_target(void)
 	errno = 0;
 	err = write(latency_target_fd, &latency_target_value, 4);
 	if (err < 1) {
-		err_msg_n(errno, "# error setting cpu_dma_latency to %d!", latency_target_value);
+		fprintf(stderr, "# error setting cpu_dma_latency to %d!: %s\n",
+			latency_target_value, strerror(errno));
 		close(latency_target_fd);
+		latency_target_fd = -1;
 		return;
 	}
 	printf("# /dev/cpu_dma_latency set to %dus\n", latency_target_value);
@@ -145,20 +151,10 @@ static int check_kernel(void)
 			kv = KV_26_LT18;
 		else if (sub < 24)
 			kv = KV_26_LT24;
-		else if (sub < 28) {
+		else
 			kv = KV_26_33;
-			strcpy(functiontracer, "ftrace");
-			strcpy(traceroptions, "iter_ctrl");
-		} else {
-			kv = KV_26_33;
-			strcpy(functiontracer, "function");
-			strcpy(traceroptions, "trace_options");
-		}
 	} else if (maj >= 3) {
 		kv = KV_30;
-		strcpy(functiontracer, "function");
-		strcpy(traceroptions, "trace_options");
-
 	} else
 		kv = KV_NOT_SUPPORTED;
 
@@ -166,29 +162,22 @@ static int check_kernel(void)
 }
 
 
-static int kernvar(int mode, const char *name, char *value, size_t sizeofvalue)
+/* Read (O_RDONLY) or write (O_WRONLY) file "filename", return 0 on success */
+static int filevar(int mode, const char *filename, char *value, size_t sizeofvalue)
 {
-	char filename[128];
 	int retval = 1;
 	int path;
-	size_t len_prefix = strlen(fileprefix), len_name = strlen(name);
-
-	if (len_prefix + len_name + 1 > sizeof(filename)) {
-		errno = ENOMEM;
-		return 1;
-	}
-
-	memcpy(filename, fileprefix, len_prefix);
-	memcpy(filename + len_prefix, name, len_name + 1);
 
-printf("KERNVAR: %s= %d / %s\n", filename, mode, value );  return 1;
-	path = open(filename, mode);
+	/* O_TRUNC: sysfs ignores it, regular files of fake tree need it */
+	path = open(filename, (mode == O_WRONLY) ? (O_WRONLY | O_TRUNC) : mode);
 	if (path >= 0) {
 		if (mode == O_RDONLY) {
 			int got;
-			if ((got = read(path, value, sizeofvalue)) > 0) {
+			if ((got = read(path, value, sizeofvalue - 1)) > 0) {
 				retval = 0;
-				value[got-1] = '\0';
+				value[got] = '\0';
+				if (value[got-1] == '\n')
+					value[got-1] = '\0';
 			}
 		} else if (mode == O_WRONLY) {
 			if (write(path, value, sizeofvalue) == sizeofvalue)
@@ -200,34 +189,50 @@ printf("KERNVAR: %s= %d / %s\n", filename, mode, value );  return 1;
 }
 
 
-static void setkernvar(const char *name, char *value)
+/* Set file "filename" to "value", back up old value for restore */
+static int setfilevar(const char *filename, char *value)
 {
 	int i;
 	char oldvalue[KVALUELEN];
 
-	if (kernelversion < KV_26_33) {
-		if (kernvar(O_RDONLY, name, oldvalue, sizeof(oldvalue)))
-			fprintf(stderr, "could not retrieve %s\n", name);
-		else {
-			for (i = 0; i < KVARS; i++) {
-				if (!strcmp(kv[i].name, name))
-					break;
-				if (kv[i].name[0] == '\0') {
-					strncpy(kv[i].name, name,
-						sizeof(kv[i].name));
-					strncpy(kv[i].value, oldvalue,
-					    sizeof(kv[i].value));
-					break;
-				}
+	if (filevar(O_RDONLY, filename, oldvalue, sizeof(oldvalue))) {
+		fprintf(stderr, "could not retrieve %s\n", filename);
+		return -1;
+	}
+	if (dry_run) {
+		printf("  %s: %s -> %s\n", filename, oldvalue, value);
+		return 0;
+	}
+	for (i = 0; i < KVARS; i++) {
+		if (!strcmp(kv[i].name, filename))
+			break;
+		if (kv[i].name[0] == '\0') {
+			if (snprintf(kv[i].name, sizeof(kv[i].name), "%s", filename) >= (int)sizeof(kv[i].name)) {
+				fprintf(stderr, "path too long: %s\n", filename);
+				return -1;
 			}
-			if (i == KVARS)
-				fprintf(stderr, "could not backup %s (%s)\n",
-					name, oldvalue);
+			memcpy(kv[i].value, oldvalue, sizeof(kv[i].value));
+			break;
 		}
 	}
-	if (kernvar(O_WRONLY, name, value, strlen(value)))
-		fprintf(stderr, "could not set %s to %s\n", name, value);
+	if (i == KVARS) {
+		fprintf(stderr, "could not backup %s (%s)\n", filename, oldvalue);
+		return -1;
+	}
+	if (filevar(O_WRONLY, filename, value, strlen(value))) {
+		fprintf(stderr, "could not set %s to %s\n", filename, value);
+		return -1;
+	}
+	return 0;
+}
 
+
+static void setkernvar(const char *name, char *value)
+{
+	char filename[MAX_PATH];
+
+	snprintf(filename, sizeof(filename), "%s%s%s", root, procfileprefix, name);
+	setfilevar(filename, value);
 }
 
 
@@ -237,57 +242,220 @@ static void restorekernvars(void)
 
 	for (i = 0; i < KVARS; i++) {
 		if (kv[i].name[0] != '\0') {
-			if (kernvar(O_WRONLY, kv[i].name, kv[i].value,
+			if (filevar(O_WRONLY, kv[i].name, kv[i].value,
 			    strlen(kv[i].value)))
 				fprintf(stderr, "could not restore %s to %s\n",
 					kv[i].name, kv[i].value);
+			kv[i].name[0] = '\0';
 		}
 	}
 }
 
 //---------------------------------------------------------------------------
+// CPU and IRQ affinity, cpufreq governor
 
-void init_kernel_tricks( void )
+/* CPU mask as comma separated 32 bit hex groups (smp_affinity format) */
+static void mask2hex(cpu_set_t *mask, char *buf, size_t size)
 {
-	lockall    = 1;
-	fileprefix = procfileprefix;
-
-	/* lock all memory (prevent swapping) */
-	if (lockall) {
-		if (mlockall(MCL_CURRENT|MCL_FUTURE) == -1) {
-			perror("mlockall");
-			goto out;
+	int groups = CPU_SETSIZE / 32;
+	int len = 0;
+	int started = 0;
+
+	buf[0] = '\0';
+	for (int g = groups - 1; g >= 0; g--) {
+		uint32_t bits = 0;
+
+		for (int b = 0; b < 32; b++) {
+			if (CPU_ISSET(g * 32 + b, mask))
+				bits |= 1U << b;
 		}
+		if (!bits && !started && g)
+			continue;
+		len += snprintf(buf + len, size - len, started ? ",%08x" : "%x", bits);
+		started = 1;
 	}
-	/* use the /dev/cpu_dma_latency trick if it's there */
-//	set_latency_target();
+}
+
+
+static void set_irq_affinity(cpu_set_t *housekeeping)
+{
+	char path[MAX_PATH];
+	char mask[KVALUELEN];
+	struct dirent *de;
+	int failed = 0;
+
+	mask2hex(housekeeping, mask, sizeof(mask));
+
+	snprintf(path, sizeof(path), "%s/proc/irq/default_smp_affinity", root);
+	setfilevar(path, mask);
+
+	snprintf(path, sizeof(path), "%s/proc/irq", root);
+	DIR *dir = opendir(path);
+	if (!dir) {
+		err_msg_2(errno, "WARN: opendir /proc/irq");
+		return;
+	}
+	while ((de = readdir(dir))) {
+		if (de->d_name[0] < '0' || de->d_name[0] > '9')
+			continue;
+		if (snprintf(path, sizeof(path), "%s/proc/irq/%s/smp_affinity", root, de->d_name) >= (int)sizeof(path))
+			continue;
+		if (setfilevar(path, mask))
+			failed++;   /* per CPU and managed IRQs refuse new affinity */
+	}
+	closedir(dir);
+	if (failed)
+		printf("# %d IRQs keep their affinity\n", failed);
+}
 
-	kernelversion = check_kernel();
 
+static void set_governor(cpu_set_t *cpus, char *governor)
+{
+	char path[MAX_PATH];
+
+	for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (!CPU_ISSET(cpu, cpus))
+			continue;
+		if (snprintf(path, sizeof(path),
+			     "%s/sys/devices/system/cpu/cpu%d/cpufreq/scaling_governor", root, cpu) >= (int)sizeof(path))
+			continue;
+		if (access(path, F_OK))
+			continue;   /* no cpufreq */
+		setfilevar(path, governor);
+	}
+}
+
+
+/* Non RT threads (main, logger, ...) inherit housekeeping affinity */
+static void set_process_affinity(cpu_set_t *housekeeping)
+{
+	char mask[KVALUELEN];
+
+	mask2hex(housekeeping, mask, sizeof(mask));
+	if (dry_run) {
+		printf("  process affinity: -> %s\n", mask);
+		return;
+	}
+	if (sched_setaffinity(0, sizeof(*housekeeping), housekeeping)) {
+		err_msg_2(errno, "WARN: sched_setaffinity");
+		return;
+	}
+	affinity_set = 1;
+}
+
+//---------------------------------------------------------------------------
+
+/* Touch stack pages of calling thread (no page faults in RT loop) */
+void prefault_stack( void )
+{
+	volatile unsigned char dummy[STACK_PREFAULT];
+
+	memset((void *)dummy, 0, sizeof(dummy));
+}
+
+
+/*
+ * SIGINT, SIGTERM, SIGHUP and SIGQUIT are blocked in all threads and taken
+ * here with sigwait(): restore runs in thread context (stdio and file
+ * writes are not async-signal-safe), then signal is raised again with
+ * default action.
+ */
+static void *restore_on_signal(void *arg)
+{
+	int sig;
+
+	if (sigwait(&restore_signals, &sig))
+		return NULL;
+	restore_kernel_tricks();
+	signal(sig, SIG_DFL);
+	pthread_sigmask(SIG_UNBLOCK, &restore_signals, NULL);
+	raise(sig);
+	return NULL;
+}
+
+
+// Apply tuning "cfg". Return 0 on success, -1 on error.
+
+int init_kernel_tricks( kt_config_t *cfg )
+{
+	cpu_set_t housekeeping;
+	char value[KVALUELEN];
+
+	root    = cfg->root ? cfg->root : "";
+	dry_run = cfg->dry_run;
+	latency_target_value = cfg->dma_latency;
+
+	if (dry_run)
+		printf("System tuning (dry run, root \"%s\"):\n", root);
+	else {
+		atexit(restore_kernel_tricks);
+		/* Before any other thread: they inherit blocked signals */
+		sigemptyset(&restore_signals);
+		sigaddset(&restore_signals, SIGINT);
+		sigaddset(&restore_signals, SIGTERM);
+		sigaddset(&restore_signals, SIGHUP);
+		sigaddset(&restore_signals, SIGQUIT);
+		pthread_sigmask(SIG_BLOCK, &restore_signals, NULL);
+		if (pthread_create(&restore_thread, NULL, restore_on_signal, NULL)) {
+			perror("pthread_create");
+			return -1;
+		}
+		pthread_detach(restore_thread);
+	}
+
+	kernelversion = check_kernel();
 	if (kernelversion == KV_NOT_SUPPORTED) {
 		warn("Running on unknown kernel version...YMMV\n");
 	}
-	setkernvar("preempt_thresh", "0");
-	setkernvar("preempt_max_latency", "0");
+	if (kernelversion < KV_26_33) {
+		setkernvar("preempt_thresh", "0");
+		setkernvar("preempt_max_latency", "0");
+	}
+
+	/* use the /dev/cpu_dma_latency trick if it's there */
+	if (cfg->dma_latency >= 0)
+		set_latency_target();
 
-	return;
+	if (cfg->timer_migration >= 0) {
+		snprintf(value, sizeof(value), "%d", cfg->timer_migration);
+		setkernvar("timer_migration", value);
+	}
 
-out:	exit( -1 );
+	if (sched_getaffinity(0, sizeof(old_affinity), &old_affinity)) {
+		perror("sched_getaffinity");
+		return -1;
+	}
+	if (cfg->governor)
+		set_governor(CPU_COUNT(&cfg->rt_cpus) ? &cfg->rt_cpus : &old_affinity, cfg->governor);
+
+	if (CPU_COUNT(&cfg->rt_cpus)) {
+		CPU_XOR(&housekeeping, &old_affinity, &cfg->rt_cpus);
+		CPU_AND(&housekeeping, &housekeeping, &old_affinity);
+		if (!CPU_COUNT(&housekeeping)) {
+			warn("no housekeeping CPU left, CPU and IRQ affinity not changed\n");
+		} else {
+			set_irq_affinity(&housekeeping);
+			set_process_affinity(&housekeeping);
+		}
+	}
+	return 0;
 }
 
 
 void restore_kernel_tricks( void )
 {
-   /* unlock everything */
-    if (lockall) {
-	munlockall();
-    }
-    /* Be a nice program, cleanup */
-    if (kernelversion < KV_26_33) {
-	restorekernvars();
+    /* Be a nice program, cleanup (signal thread and atexit may race) */
+    pthread_mutex_lock(&restore_lock);
+    restorekernvars();
+
+    if (affinity_set) {
+	sched_setaffinity(0, sizeof(old_affinity), &old_affinity);
+	affinity_set = 0;
     }
     /* close the latency_target_fd if it's open */
     if (latency_target_fd >= 0) {
 	close(latency_target_fd);
+	latency_target_fd = -1;
     }
+    pthread_mutex_unlock(&restore_lock);
 }
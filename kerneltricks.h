@@ -0,0 +1,49 @@
+//
+// File:  kerneltricks.h
+//
+// System tuning for RT measurement (tricks from "cyclictest.c")
+//
+// Every setting is read before it is written and written back by
+// restore_kernel_tricks() (atexit and SIGINT/SIGTERM/SIGHUP/SIGQUIT):
+//
+//      /dev/cpu_dma_latency                    held open (no deep C-states)
+//      /proc/sys/kernel/timer_migration        0 (timers stay on own CPU)
+//      /sys/.../cpuN/cpufreq/scaling_governor  governor of RT CPUs
+//      /proc/irq/default_smp_affinity          housekeeping CPUs
+//      /proc/irq/N/smp_affinity                housekeeping CPUs
+//      process CPU affinity                    housekeeping CPUs (non RT threads)
+//
+// Housekeeping CPUs == allowed CPUs - RT CPUs. All paths are prefixed with
+// "root" (test against fake sysfs/procfs tree). Dry run only reports
+// current and new values.
+//
+
+#ifndef  KERNELTRICKS_H
+#define  KERNELTRICKS_H
+
+#include <sched.h>                // cpu_set_t (needs _GNU_SOURCE)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+typedef struct  {
+    char       *root;          // Prefix of /dev, /proc, /sys ("" == real system)
+    int         dry_run;       // Report only, change nothing
+    int         dma_latency;   // cpu_dma_latency [us], -1 == keep
+    char       *governor;      // cpufreq governor of RT CPUs, NULL == keep
+    int         timer_migration;  // -1 == keep
+    cpu_set_t   rt_cpus;       // CPUs of RT threads, empty == not pinned
+} kt_config_t;
+
+
+int   init_kernel_tricks( kt_config_t *cfg );
+void  restore_kernel_tricks( void );
+void  prefault_stack( void );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // KERNELTRICKS_H
@@ -0,0 +1,243 @@
+//
+// File:  loadgen.c
+//
+// Background load generators for latency under stress
+//
+
+#define _GNU_SOURCE              // MAP_ANONYMOUS, RUSAGE_THREAD
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+
+#include "suppfunc.h"
+#include "loadgen.h"
+
+#define SLICE_ns        10000000          // Duty cycle slice
+#define MEMBW_SIZE      (64 << 20)
+#define CACHE_SIZE      (32 << 20)
+#define FAULT_SIZE      (4 << 20)
+
+load_t   loads[MAX_LOADS];
+int      nloads;
+int      load_phase = LOAD_IDLE;
+
+static int  stop;
+static char *names[LOAD_TAGS] = { "idle", "membw", "cache", "syscall", "fork", "pagefault", "all" };
+
+//---------------------------------------------------------------------------
+
+// Parse "type[,cpu[,intensity]]", return 0 on success
+
+int load_parse( char *arg )
+{
+    char  *cpu, *intensity;
+    int    type;
+
+    if ( nloads >= MAX_LOADS ) {
+        printf("ERROR: Max %d load threads\n", MAX_LOADS);
+        return -1;
+    }
+    load_t  *l = &loads[nloads];
+
+    l->cpu       = -1;
+    l->intensity = 100;
+    cpu = strchr( arg, ',' );
+    if ( cpu ) {
+        *cpu++    = 0;
+        intensity = strchr( cpu, ',' );
+        if ( intensity ) {
+            *intensity++ = 0;
+            l->intensity = atoi( intensity );
+        }
+        if ( *cpu ) {
+            l->cpu = atoi( cpu );
+        }
+    }
+    for ( type = LOAD_MEMBW; type <= LOAD_PAGEFAULT; type++ ) {
+        if ( !strcmp(arg, names[type]) ) {
+            break;
+        }
+    }
+    if ( type > LOAD_PAGEFAULT ) {
+        printf("ERROR: Unknown load %s (membw, cache, syscall, fork, pagefault)\n", arg);
+        return -1;
+    }
+    if ( (l->intensity < 1) || (l->intensity > 100) ) {
+        printf("ERROR: Load intensity must be 1...100 %%\n");
+        return -1;
+    }
+    l->type = type;
+    nloads++;
+    return 0;
+}
+
+
+char *load_name( int tag )
+{
+    return ((tag >= 0) && (tag < LOAD_TAGS)) ? names[tag] : "?";
+}
+
+
+void load_stop( void )
+{
+    __atomic_store_n( &stop, 1, __ATOMIC_RELAXED );
+}
+
+//---------------------------------------------------------------------------
+// Load work: run until "end_ns"
+
+static void work( int type, char *buf, char *buf2, int64_t end_ns )
+{
+    static __thread uint32_t  rnd = 12345;
+
+    while ( clock_ns(CLOCK_MONOTONIC) < end_ns ) {
+        switch ( type ) {
+            case LOAD_MEMBW:
+                for ( int off = 0; off < MEMBW_SIZE; off += (1 << 20) ) {
+                    memcpy( buf2 + off, buf + off, 1 << 20 );
+                }
+                break;
+            case LOAD_CACHE:
+                for ( int ix = 0; ix < 100000; ix++ ) {
+                    rnd = rnd * 1103515245 + 12345;
+                    buf[ (rnd >> 6) % (CACHE_SIZE / 64) * 64 ]++;
+                }
+                break;
+            case LOAD_SYSCALL:
+                for ( int ix = 0; ix < 1000; ix++ ) {
+                    syscall( SYS_getppid );
+                }
+                break;
+            case LOAD_FORK: {
+                pid_t  pid = fork();
+
+                if ( pid == 0 ) {
+                    execl( "/bin/true", "true", (char *)NULL );
+                    _exit( 0 );
+                }
+                if ( pid > 0 ) {
+                    waitpid( pid, NULL, 0 );
+                }
+                break;
+            }
+            case LOAD_PAGEFAULT: {
+                // mlockall(MCL_FUTURE) of RT process populates mapping at
+                // once: unlock and drop pages, so each touch faults
+                char  *p = mmap( NULL, FAULT_SIZE, PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+
+                if ( p != MAP_FAILED ) {
+                    munlock( p, FAULT_SIZE );
+                    madvise( p, FAULT_SIZE, MADV_DONTNEED );
+                    for ( int off = 0; off < FAULT_SIZE; off += 4096 ) {
+                        p[off] = 1;
+                    }
+                    munmap( p, FAULT_SIZE );
+                }
+                break;
+            }
+        }
+    }
+}
+
+
+// Load thread: "arg" == load_t. Busy "intensity" % of each slice while
+// own load type is active in current phase.
+
+void *threadLoad( void *arg )
+{
+    load_t           *l    = arg;
+    char             *buf  = NULL, *buf2 = NULL;
+    struct timespec   idle = { 0, SLICE_ns };
+    struct rusage     ru0, ru;
+
+    if ( l->type == LOAD_MEMBW ) {
+        buf  = malloc( MEMBW_SIZE );
+        buf2 = malloc( MEMBW_SIZE );
+    }
+    if ( l->type == LOAD_CACHE ) {
+        buf  = malloc( CACHE_SIZE );
+    }
+    if ( ((l->type == LOAD_MEMBW) && (!buf || !buf2)) || ((l->type == LOAD_CACHE) && !buf) ) {
+        printf("ERROR: Load %s: out of memory\n", names[l->type]);
+        return NULL;
+    }
+    // Load buffers are not RT memory: no need to keep them locked.
+    // Written before munlock(), which would otherwise get uninitialized
+    // malloc() memory (-Wmaybe-uninitialized).
+    if ( buf ) {
+        size_t  size = (l->type == LOAD_MEMBW) ? MEMBW_SIZE : CACHE_SIZE;
+
+        memset( buf, 1, size );
+        munlock( buf, size );
+    }
+    if ( buf2 ) {
+        memset( buf2, 0, MEMBW_SIZE );
+        munlock( buf2, MEMBW_SIZE );
+    }
+    getrusage( RUSAGE_THREAD, &ru0 );
+
+    while ( !__atomic_load_n(&stop, __ATOMIC_RELAXED) ) {
+        int  phase = __atomic_load_n( &load_phase, __ATOMIC_RELAXED );
+
+        if ( (phase != l->type) && (phase != LOAD_ALL) ) {
+            nanosleep( &idle, NULL );
+            continue;
+        }
+        int64_t          busy_ns = (int64_t)SLICE_ns * l->intensity / 100;
+        struct timespec  rest    = ns2ts( SLICE_ns - busy_ns );
+
+        work( l->type, buf, buf2, clock_ns(CLOCK_MONOTONIC) + busy_ns );
+        if ( busy_ns < SLICE_ns ) {
+            nanosleep( &rest, NULL );
+        }
+    }
+    getrusage( RUSAGE_THREAD, &ru );
+    if ( l->type == LOAD_PAGEFAULT ) {
+        printf("Load pagefault: %ld minor faults\n", ru.ru_minflt - ru0.ru_minflt);
+    }
+    free( buf );
+    free( buf2 );
+    return NULL;
+}
+
+
+// Phase thread: "arg" == phase length [s]. Phases: idle, then each
+// configured load type alone. Phase length 0: all loads on whole run.
+
+void *threadLoadPhase( void *arg )
+{
+    int              seconds = *(int *)arg;
+    int              phases[LOAD_TAGS] = { LOAD_IDLE };
+    int              nphases = 1;
+    struct timespec  tick = { 0, 100000000 };
+
+    if ( !seconds ) {
+        __atomic_store_n( &load_phase, LOAD_ALL, __ATOMIC_RELAXED );
+        return NULL;
+    }
+    for ( int type = LOAD_MEMBW; type <= LOAD_PAGEFAULT; type++ ) {
+        for ( int ix = 0; ix < nloads; ix++ ) {
+            if ( loads[ix].type == type ) {
+                phases[nphases++] = type;
+                break;
+            }
+        }
+    }
+    for ( int phase = 0, ticks = 0; !__atomic_load_n(&stop, __ATOMIC_RELAXED); ) {
+        nanosleep( &tick, NULL );
+        if ( ++ticks >= 10 * seconds ) {
+            ticks = 0;
+            phase = (phase + 1) % nphases;
+            __atomic_store_n( &load_phase, phases[phase], __ATOMIC_RELAXED );
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,61 @@
+//
+// File:  loadgen.h
+//
+// Background load generators for latency under stress
+//
+// Each load thread runs one load type on own CPU (or unpinned) with given
+// intensity (busy % of each 10 ms slice):
+//
+//      membw       memcpy() streaming between two 64 MB buffers
+//      cache       random read-modify-write over 32 MB (cache and TLB thrash)
+//      syscall     getppid() storm
+//      fork        fork() + exec of /bin/true
+//      pagefault   mmap() + touch + munmap() of 4 MB
+//
+// Phase thread switches load phases: idle, then each configured load type
+// alone, phase length given in seconds (0 == all loads on all the time).
+// RT threads tag each sample with current phase (load_phase), so latency
+// histograms are split by load type.
+//
+
+#ifndef  LOADGEN_H
+#define  LOADGEN_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#define MAX_LOADS     16
+
+#define LOAD_IDLE      0        // Load tags (phases)
+#define LOAD_MEMBW     1
+#define LOAD_CACHE     2
+#define LOAD_SYSCALL   3
+#define LOAD_FORK      4
+#define LOAD_PAGEFAULT 5
+#define LOAD_ALL       6
+#define LOAD_TAGS      7
+
+typedef struct  {
+    int    type;                // LOAD_MEMBW ... LOAD_PAGEFAULT
+    int    cpu;                 // -1 == not pinned
+    int    intensity;           // Busy % of 10 ms slice, 1...100
+} load_t;
+
+extern load_t  loads[MAX_LOADS];
+extern int     nloads;
+extern int     load_phase;      // Current load tag, read by RT threads
+
+
+int    load_parse( char *arg );
+char  *load_name( int tag );
+void  *threadLoad( void *arg );
+void  *threadLoadPhase( void *arg );
+void   load_stop( void );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LOADGEN_H
@@ -0,0 +1,26 @@
+//
+// File:  outlier.c
+//
+// Wait-free single producer / single consumer ring of outlier records
+//
+
+#include <stdint.h>
+
+#include "outlier.h"
+
+//---------------------------------------------------------------------------
+
+// Logger thread side: return 1 when record is copied to "rec", 0 when ring is empty
+
+int outlier_pop( outlier_ring_t *r, outlier_t *rec )
+{
+    uint32_t  tail = r->tail;
+    uint32_t  head = __atomic_load_n( &r->head, __ATOMIC_ACQUIRE );
+
+    if ( head == tail ) {
+        return 0;
+    }
+    *rec = r->ring[ tail & (OUTLIER_RING_SIZE - 1) ];
+    __atomic_store_n( &r->tail, tail + 1, __ATOMIC_RELEASE );
+    return 1;
+}
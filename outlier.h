@@ -0,0 +1,68 @@
+//
+// File:  outlier.h
+//
+// Wait-free single producer / single consumer ring of outlier records.
+//
+// RT thread (producer) pushes record when latency crosses threshold, low
+// priority logger thread (consumer) drains ring and formats output. When
+// ring is full record is dropped and counted, RT thread never waits.
+//
+
+#ifndef  OUTLIER_H
+#define  OUTLIER_H
+
+#include <stdint.h>
+#include "perf.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#define OUTLIER_RING_SIZE   256     // Must be power of two
+#ifndef CACHE_LINE
+#define CACHE_LINE          64
+#endif
+
+typedef struct  {
+    int64_t   counter;        // Sample counter of metrics bank
+    int32_t   cpu;            // CPU of RT thread (-1 == not pinned)
+    int64_t   latency_ns;
+    int64_t   time_ns;        // Wake up time, CLOCK_MONOTONIC [ns]
+    int32_t   faults;         // Page faults of RT thread in this period
+    int32_t   nivcsw;         // Involuntary context switches in this period
+    int32_t   perf[PERF_EVENTS];  // Perf counter deltas in this period (-P)
+} outlier_t;
+
+typedef struct  {
+    uint32_t  head  __attribute__((aligned(CACHE_LINE)));   // Producer
+    uint32_t  dropped;                                      // Producer
+    uint32_t  tail  __attribute__((aligned(CACHE_LINE)));   // Consumer
+    outlier_t ring[OUTLIER_RING_SIZE] __attribute__((aligned(CACHE_LINE)));
+} outlier_ring_t;
+
+
+int  outlier_pop( outlier_ring_t *r, outlier_t *rec );
+
+
+// RT thread side: return 0 when record is queued, -1 when ring is full
+
+static inline int outlier_push( outlier_ring_t *r, const outlier_t *rec )
+{
+    uint32_t  head = r->head;
+    uint32_t  tail = __atomic_load_n( &r->tail, __ATOMIC_ACQUIRE );
+
+    if ( head - tail >= OUTLIER_RING_SIZE ) {
+        __atomic_store_n( &r->dropped, r->dropped + 1, __ATOMIC_RELAXED );
+        return -1;
+    }
+    r->ring[ head & (OUTLIER_RING_SIZE - 1) ] = *rec;
+    __atomic_store_n( &r->head, head + 1, __ATOMIC_RELEASE );
+    return 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // OUTLIER_H
@@ -0,0 +1,187 @@
+//
+// File:  perf.c
+//
+// Per wake up perf counters of RT thread (see perf.h)
+//
+
+#define _GNU_SOURCE              // syscall()
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "perf.h"
+
+static char *names[PERF_EVENTS] = { "csw", "migr", "fault", "cmiss" };
+
+static struct  {
+    uint32_t  type;
+    uint64_t  config;
+} events[PERF_EVENTS] = {
+    { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+    { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS   },
+    { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS      },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES     },
+};
+
+//---------------------------------------------------------------------------
+
+static int event_open( int event, int group_fd, uint64_t read_format )
+{
+    struct perf_event_attr  attr;
+
+    memset( &attr, 0, sizeof(attr) );
+    attr.size           = sizeof(attr);
+    attr.type           = events[event].type;
+    attr.config         = events[event].config;
+    attr.read_format    = read_format;
+    // Context switches and migrations are raised by scheduler with kernel
+    // regs (exclude_kernel would filter all), page faults and cache misses
+    // count user space only (allowed with perf_event_paranoid 2)
+    attr.exclude_kernel = (event != PERF_CSW) && (event != PERF_MIGR);
+    attr.disabled       = (group_fd < 0);
+    return syscall( SYS_perf_event_open, &attr, 0, -1, group_fd, 0 );
+}
+
+
+// Open counters of calling thread. Return mask of opened events
+// (0 == perf not available, RT thread runs without counters).
+
+int perf_open( perf_t *p )
+{
+    int  leader = -1;
+
+    memset( p, 0, sizeof(*p) );
+    for ( int ev = 0; ev < PERF_EVENTS; ev++ ) {
+        p->fd[ev] = -1;
+    }
+
+    // Software group
+    for ( int ev = PERF_CSW; ev <= PERF_FAULT; ev++ ) {
+        p->fd[ev] = event_open( ev, leader, PERF_FORMAT_GROUP );
+        if ( p->fd[ev] < 0 ) {
+            continue;
+        }
+        if ( leader < 0 ) {
+            leader = p->fd[ev];
+        }
+        p->mask |= 1 << ev;
+    }
+    if ( leader >= 0 ) {
+        ioctl( leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP );
+    }
+
+    // Hardware counter alone: its scheduling never disables software group
+    p->fd[PERF_CMISS] = event_open( PERF_CMISS, -1, 0 );
+    if ( p->fd[PERF_CMISS] >= 0 ) {
+        p->page = mmap( NULL, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, p->fd[PERF_CMISS], 0 );
+        if ( p->page == MAP_FAILED ) {
+            p->page = NULL;
+        }
+        ioctl( p->fd[PERF_CMISS], PERF_EVENT_IOC_ENABLE, 0 );
+        p->mask |= 1 << PERF_CMISS;
+    }
+
+    int32_t  delta[PERF_EVENTS];
+
+    perf_read( p, delta );          // Start values
+    return p->mask;
+}
+
+
+// Hardware counter: rdpmc through mmap page (seqlock of kernel), read()
+// when user space access is not allowed
+
+static uint64_t read_hw( perf_t *p )
+{
+    struct perf_event_mmap_page  *pc = p->page;
+    uint64_t                      count;
+
+#if defined(__x86_64__) || defined(__i386__)
+    if ( pc ) {
+        uint32_t  seq, idx;
+
+        do {
+            seq = pc->lock;
+            __atomic_signal_fence( __ATOMIC_SEQ_CST );
+            idx = pc->index;
+            if ( !pc->cap_user_rdpmc || !idx ) {
+                break;
+            }
+            uint32_t  lo, hi;
+            int       width = pc->pmc_width;
+
+            __asm__ volatile( "rdpmc" : "=a"(lo), "=d"(hi) : "c"(idx - 1) );
+            count  = ((uint64_t)hi << 32) | lo;
+            count  = (uint64_t)((int64_t)(count << (64 - width)) >> (64 - width));
+            count += pc->offset;
+            __atomic_signal_fence( __ATOMIC_SEQ_CST );
+            if ( pc->lock == seq ) {
+                return count;
+            }
+        } while ( 1 );
+    }
+#endif
+    if ( read(p->fd[PERF_CMISS], &count, sizeof(count)) != sizeof(count) ) {
+        return p->prev[PERF_CMISS];
+    }
+    return count;
+}
+
+
+// Counter deltas since previous call (events not in "mask" are 0).
+// Return 0 on success.
+
+int perf_read( perf_t *p, int32_t *delta )
+{
+    uint64_t  now[PERF_EVENTS] = { 0 };
+
+    if ( p->mask & ((1 << PERF_CMISS) - 1) ) {
+        struct { uint64_t nr; uint64_t value[3]; }  group;
+        int  leader = (p->fd[PERF_CSW] >= 0) ? p->fd[PERF_CSW] :
+                      (p->fd[PERF_MIGR] >= 0) ? p->fd[PERF_MIGR] : p->fd[PERF_FAULT];
+
+        if ( read(leader, &group, sizeof(group)) <= 0 ) {
+            return -1;
+        }
+        for ( int ev = PERF_CSW, ix = 0; ev <= PERF_FAULT; ev++ ) {
+            if ( p->mask & (1 << ev) ) {
+                now[ev] = group.value[ix++];
+            }
+        }
+    }
+    if ( p->mask & (1 << PERF_CMISS) ) {
+        now[PERF_CMISS] = read_hw( p );
+    }
+    for ( int ev = 0; ev < PERF_EVENTS; ev++ ) {
+        delta[ev]   = now[ev] - p->prev[ev];
+        p->prev[ev] = now[ev];
+    }
+    return 0;
+}
+
+
+void perf_close( perf_t *p )
+{
+    if ( p->page ) {
+        munmap( p->page, sysconf(_SC_PAGESIZE) );
+    }
+    for ( int ev = 0; ev < PERF_EVENTS; ev++ ) {
+        if ( p->fd[ev] >= 0 ) {
+            close( p->fd[ev] );
+        }
+    }
+    p->mask = 0;
+}
+
+
+char *perf_name( int event )
+{
+    return ((event >= 0) && (event < PERF_EVENTS)) ? names[event] : "?";
+}
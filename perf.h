@@ -0,0 +1,67 @@
+//
+// File:  perf.h
+//
+// Per wake up perf counters of RT thread (perf_event_open)
+//
+// Counters count calling thread only (any CPU):
+//
+//      csw         context switches            software
+//      migr        CPU migrations              software
+//      fault       page faults                 software
+//      cmiss       cache misses                hardware (when PMU is there)
+//
+// Software counters are one group, read with one read() per wake up (they
+// have no PMU index, so no rdpmc). Hardware counter is read from its mmap
+// page with rdpmc (x86) when kernel allows user space access, else with
+// read(). Events which can not be opened (no PMU, perf_event_paranoid,
+// container) are left out, "mask" tells which counters are valid.
+//
+
+#ifndef  PERF_H
+#define  PERF_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#define PERF_CSW        0
+#define PERF_MIGR       1
+#define PERF_FAULT      2
+#define PERF_CMISS      3
+#define PERF_EVENTS     4
+
+#define PERF_BUCKETS    33      // Latency buckets: <= 2^k ns, k = 0 ... 32
+
+typedef struct  {
+    int       fd[PERF_EVENTS];
+    int       mask;             // Bit per opened event (1 << PERF_...)
+    void     *page;             // mmap page of hardware counter (rdpmc)
+    uint64_t  prev[PERF_EVENTS];
+} perf_t;
+
+typedef struct  {
+    int64_t   samples;          // Samples with latency in bucket
+    int64_t   sum[PERF_EVENTS]; // Sum of counter deltas of these samples
+} perf_bucket_t;
+
+
+int    perf_open( perf_t *p );
+int    perf_read( perf_t *p, int32_t *delta );
+void   perf_close( perf_t *p );
+char  *perf_name( int event );
+
+static inline int perf_bucket( int64_t latency_ns )
+{
+    int  k = (latency_ns > 1) ? 64 - __builtin_clzll( latency_ns - 1 ) : 0;
+
+    return (k < PERF_BUCKETS) ? k : PERF_BUCKETS - 1;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PERF_H
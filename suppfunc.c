@@ -4,6 +4,8 @@
 // Various application support functions
 //
 
+#define _GNU_SOURCE         // RUSAGE_THREAD
+
 #include <stdint.h>
 #include <stdlib.h>         // exit()
 #include <stdio.h>          // perror()
@@ -11,16 +13,18 @@
 #include <time.h>           // struct timespec
 #include <sys/mman.h>       // mlockall(), munlockall, mmap(), munmap()
 #include <string.h>         // memset()
+#include <stddef.h>         // offsetof()
 #include <unistd.h>         // getuid()
+#include <sys/syscall.h>    // SYS_sched_setattr
 
 //#include <sys/types.h>
-//#include <sys/stat.h>
+#include <sys/stat.h>       // fstat()
 #include <fcntl.h>          // O_CREAT,...
 
 #include "suppfunc.h"
 
 extern int  RT_PERIOD;                  // RT_PERIOD units [us]
-static int  TRESHOLD = (HISTOSIZE-1);   // TRESHOLD  units [us]
+static int64_t  TRESHOLD = 5000000;     // TRESHOLD  units [ns]
 
 //---------------------------------------------------------------------------
 
@@ -44,6 +48,74 @@ void lock_memory( void )
     }
 }
 
+
+// Touch every page of "addr" (keep content), so first RT period takes no
+// page faults even when mlock() failed
+
+void prefault( void *addr, size_t size )
+{
+    volatile char  *p    = addr;
+    long            page = sysconf( _SC_PAGESIZE );
+
+    for ( size_t off = 0; off < size; off += page ) {
+        p[off] = p[off];
+    }
+}
+
+
+// Page faults and involuntary context switches of calling thread since
+// previous call ("prev" == thread private counters of previous call)
+
+void thread_rusage( struct rusage *prev, sample_t *sample )
+{
+    struct rusage  ru;
+
+    if ( getrusage(RUSAGE_THREAD, &ru) ) {
+        return;
+    }
+    sample->minflt = ru.ru_minflt - prev->ru_minflt;
+    sample->majflt = ru.ru_majflt - prev->ru_majflt;
+    sample->nivcsw = ru.ru_nivcsw - prev->ru_nivcsw;
+    *prev = ru;
+}
+
+
+// SCHED_DEADLINE: no glibc wrapper for sched_setattr(), local copy of
+// kernel's struct sched_attr
+
+#define SCHED_FLAG_DL_OVERRUN  0x04     // SIGXCPU on runtime overrun
+
+typedef struct  {
+    uint32_t  size;
+    uint32_t  sched_policy;
+    uint64_t  sched_flags;
+    int32_t   sched_nice;
+    uint32_t  sched_priority;
+    uint64_t  sched_runtime;            // [ns]
+    uint64_t  sched_deadline;
+    uint64_t  sched_period;
+} dl_attr_t;
+
+
+// Set calling thread to SCHED_DEADLINE. Return 0 on success, -1 on error.
+
+int set_sched_deadline( int64_t runtime_ns, int64_t deadline_ns, int64_t period_ns )
+{
+    dl_attr_t  attr = { 0 };
+
+    attr.size           = sizeof(attr);
+    attr.sched_policy   = SCHED_DEADLINE;
+    attr.sched_flags    = SCHED_FLAG_DL_OVERRUN;
+    attr.sched_runtime  = runtime_ns;
+    attr.sched_deadline = deadline_ns;
+    attr.sched_period   = period_ns;
+    if ( syscall(SYS_sched_setattr, 0, &attr, 0) ) {
+        perror("sched_setattr");
+        return -1;
+    }
+    return 0;
+}
+
 //---------------------------------------------------------------------------
 // Following two example codes are from web sources.
 // Function "timer_end" is suspious!
@@ -164,91 +236,388 @@ int64_t tsDiffus( struct timespec start, struct timespec end )
 
 //---------------------------------------------------------------------------
 
-void update_metrics( metrics_t *metrics, int latency_us, struct timespec now )
+// Seqlock writer/reader helpers (RT thread is the only writer)
+
+static inline void seq_write_begin( uint32_t *seq )
+{
+    __atomic_store_n( seq, *seq + 1, __ATOMIC_RELAXED );
+    __atomic_thread_fence( __ATOMIC_RELEASE );
+}
+
+static inline void seq_write_end( uint32_t *seq )
+{
+    __atomic_store_n( seq, *seq + 1, __ATOMIC_RELEASE );
+}
+
+
+// Overrun burst lengths (linear buckets, see burst_hist_t)
+
+static inline void burst_record( burst_hist_t *b, int periods )
+{
+    if ( periods < BURST_BUCKETS ) {
+        b->count[periods]++;
+    }
+    else {
+        b->over++;
+    }
+    if ( periods > b->max ) {
+        b->max = periods;
+    }
+    b->total++;
+}
+
+
+static void burst_merge( burst_hist_t *dst, burst_hist_t *src )
+{
+    for ( int ix = 0; ix < BURST_BUCKETS; ix++ ) {
+        dst->count[ix] += src->count[ix];
+    }
+    dst->over  += src->over;
+    dst->total += src->total;
+    if ( src->max > dst->max ) {
+        dst->max = src->max;
+    }
+}
+
+
+static int64_t burst_percentile( burst_hist_t *b, double percentile )
+{
+    int64_t  target = (int64_t)((percentile / 100.0) * b->total + 0.5);
+    int64_t  sum    = 0;
+
+    if ( target < 1 ) {
+        target = 1;
+    }
+    for ( int ix = 0; ix < BURST_BUCKETS; ix++ ) {
+        sum += b->count[ix];
+        if ( sum >= target ) {
+            return ix;
+        }
+    }
+    return b->max;
+}
+
+//---------------------------------------------------------------------------
+
+// Clear metrics bank and set histogram layouts
+
+void init_metrics( metrics_t *metrics, int digits )
 {
-    static int flagPERIOD = 0;
-    static int flagPRINT  = 0;
+    memset( metrics, 0, sizeof(metrics_t) );
+    hdr_init( &metrics->hist,     digits );
+}
 
-    if ( metrics->reset ) {
-         memset( metrics, 0, sizeof(metrics_t) );
-         flagPERIOD = 0;
-         flagPRINT  = 0;
 
-         // Following is enough accurate
-         struct timespec  timestamp;
-         clock_gettime( CLOCK_MONOTONIC, &timestamp );
-         metrics->start = tsSubus( timestamp, RT_PERIOD+latency_us );
+void init_detail( metrics_detail_t *detail, int digits )
+{
+    memset( detail, 0, sizeof(metrics_detail_t) );
+    hdr_init( &detail->response, digits );
+    for ( int ix = 0; ix < LOAD_TAGS; ix++ ) {
+        hdr_init( &detail->load[ix], digits );
+    }
+    for ( int ix = 0; ix < MAX_TASKS; ix++ ) {
+        hdr_init( &detail->task[ix].exec, digits );
     }
+}
+
+
+// Record release latency, jitter, execution and response times of tasks
+// released at this wake up
+
+static void update_tasks( thread_metrics_t *tm, metrics_detail_t *detail, sample_t *sample )
+{
+    task_sample_t  *ts      = &sample->tasks;
+    int64_t         wake_ns = sample->now_ns - sample->latency_ns;
+    int64_t         done_ns = 0;
+
+    for ( int ix = 0; ix < ts->ntasks; ix++ ) {
+        if ( !(ts->released & (1 << ix)) ) {
+            continue;
+        }
+        task_metrics_t  *tk       = &detail->task[ix];
+        task_config_t   *cfg      = &tm->task[ix];
+        int64_t          exec     = ts->exec_ns[ix];
+        int64_t          lat      = ts->start_ns[ix] - ts->release_ns[ix];
+        int64_t          resp     = ts->done_ns[ix]  - ts->release_ns[ix];
+        int64_t          deadline = cfg->deadline_ns ? cfg->deadline_ns :
+                                    cfg->period_ns   ? cfg->period_ns   : tm->period_ns;
+
+        hdr_record( &tk->exec, exec );
+        tk->exec_sum_ns += exec;
+        tk->lat_sum_ns  += lat;
+        tk->resp_sum_ns += resp;
+        if ( !tk->count++ ) {
+             tk->lat_min_ns  = lat;
+             tk->resp_min_ns = resp;
+        }
+        if ( lat  < tk->lat_min_ns  )  tk->lat_min_ns  = lat;
+        if ( lat  > tk->lat_max_ns  )  tk->lat_max_ns  = lat;
+        if ( resp < tk->resp_min_ns )  tk->resp_min_ns = resp;
+        if ( resp > tk->resp_max_ns )  tk->resp_max_ns = resp;
+
+        if ( ts->jitter_ns[ix] >= 0 ) {
+             tk->jitter_sum_ns += ts->jitter_ns[ix];
+             if ( ts->jitter_ns[ix] > tk->jitter_max_ns ) {
+                  tk->jitter_max_ns = ts->jitter_ns[ix];
+             }
+        }
+        if ( cfg->budget_ns && (exec > cfg->budget_ns) ) {
+             tk->budget_overruns++;
+        }
+        if ( resp > deadline ) {
+             tk->deadline_misses++;
+        }
+        tk->missed_periods += ts->missed[ix];
+        if ( ts->done_ns[ix] > done_ns ) {
+             done_ns = ts->done_ns[ix];
+        }
+    }
+    if ( done_ns ) {
+        hdr_record( &detail->response, done_ns - wake_ns );
+    }
+}
+
+
+// Return 1 when latency crosses TRESHOLD (first sample of burst), caller
+// queues outlier record for logger thread (no stdio in RT thread).
+
+int update_metrics( thread_metrics_t *tm, sample_t *sample )
+{
+    int64_t     latency_ns = sample->latency_ns;
+    int64_t     now_ns     = sample->now_ns;
+    metrics_t  *metrics;
+    int         outlier = 0;
+    int64_t     period_ns = 1000 * (int64_t)RT_PERIOD;
+    uint32_t    req = __atomic_load_n( &tm->reset_req, __ATOMIC_ACQUIRE );
+
+    seq_write_begin( &tm->seq );
+
+    if ( req != tm->reset_ack ) {
+         // Reader has cleared inactive bank: swap to it
+         tm->active     ^= 1;
+         tm->flagPRINT   = 0;
+         tm->bank[tm->active].start_ns = now_ns - period_ns - latency_ns;
+         __atomic_store_n( &tm->reset_ack, req, __ATOMIC_RELEASE );
+    }
+    metrics = &tm->bank[tm->active];
 
     metrics->counter++;
-    metrics->sum_us += latency_us;
+    metrics->sum_ns += latency_ns;
 
-    if ( (latency_us < HISTOSIZE)  &&  (latency_us > 0) ) {
-         metrics->histogram[latency_us]++;
+    hdr_record( &metrics->hist, latency_ns );
+    if ( tm->loads ) {
+        hdr_record( &tm->detail[tm->active].load[sample->load], latency_ns );
     }
-    else {
-         metrics->histogram[0]++;
+
+    // Overrun policy results: RT period without tasks in index 0
+    task_sample_t  *ts = &sample->tasks;
+
+    for ( int ix = 0; ix < (ts->ntasks ? ts->ntasks : 1); ix++ ) {
+        if ( ts->ntasks && !(ts->released & (1 << ix)) ) {
+            continue;
+        }
+        metrics->missed += ts->missed[ix];
+        if ( ts->burst[ix] ) {
+            burst_record( &metrics->burst, ts->burst[ix] );
+        }
     }
-    if ( latency_us < RT_PERIOD ) {
-         flagPERIOD = 0;
+    if ( latency_ns < TRESHOLD ) {
+         tm->flagPRINT  = 0;
     }
-    if ( latency_us >= RT_PERIOD && !flagPERIOD ) {
-         flagPERIOD = 1;
-         metrics->late_count++;
-         metrics->late_sum_us += latency_us - RT_PERIOD;
+    if ( latency_ns >= TRESHOLD && !tm->flagPRINT ) {
+         tm->flagPRINT = 1;
+         outlier       = 1;
     }
-    if ( latency_us < TRESHOLD ) {
-         flagPRINT  = 0;
+    metrics->spin_sum_ns += sample->spin_ns;
+    metrics->spin_miss   += sample->spin_miss;
+    metrics->dl_throttled += sample->dl_throttled;
+    metrics->dl_missed    += sample->dl_miss;
+    metrics->stop_ns      = now_ns;
+    if ( sample->minflt | sample->majflt | sample->nivcsw ) {
+        metrics->minflt += sample->minflt;
+        metrics->majflt += sample->majflt;
+        metrics->nivcsw += sample->nivcsw;
+        if ( (sample->minflt | sample->majflt) && (latency_ns > metrics->fault_max_ns) ) {
+            metrics->fault_max_ns = latency_ns;
+        }
     }
-    if ( latency_us >= TRESHOLD && !flagPRINT ) {
-         #define SPACE 0x20
-         flagPRINT = 1;
-//       printf("%d/%d\n", metrics->counter, latency_us );
-         printf("%8d /%2d.%03d %c\n", metrics->counter, latency_us / 1000, latency_us % 1000,
-                (latency_us > RT_PERIOD) ? '*' : SPACE );
+
+    if ( sample->perf_mask ) {
+        perf_bucket_t  *b = &metrics->perf[ perf_bucket(latency_ns) ];
+
+        b->samples++;
+        for ( int ev = 0; ev < PERF_EVENTS; ev++ ) {
+            b->sum[ev] += sample->perf[ev];
+        }
     }
-    if (  metrics->max_lat < latency_us ) {
-          metrics->max_lat = latency_us;
+    if ( ts->ntasks ) {
+        update_tasks( tm, &tm->detail[tm->active], sample );
     }
-    metrics->stop = now;
+
+    seq_write_end( &tm->seq );
+    return outlier;
 }
 
 
-void print_metrics( metrics_t *metrics )
+// Copy consistent snapshot of active metrics bank, and its detail when
+// "detail" != NULL. Return 0 on success, -1 if writer did not let us
+// through (copy may be torn).
+
+int snapshot_metrics( thread_metrics_t *tm, metrics_t *copy, metrics_detail_t *detail )
 {
-    double  runtime  = tsDiffus( metrics->start, metrics->stop );
-    double  rounds   = runtime / RT_PERIOD;
+    for ( int retry = 0; retry < 10000; retry++ ) {
+        uint32_t  seq1 = __atomic_load_n( &tm->seq, __ATOMIC_ACQUIRE );
 
-    double  awg_ms   = metrics->sum_us;
-            awg_ms  /= metrics->counter;
-            awg_ms  /= 1000.0;
+        if ( seq1 & 1 ) {
+            continue;
+        }
+        memcpy( copy, &tm->bank[tm->active], sizeof(metrics_t) );
+        if ( detail ) {
+            memcpy( detail, &tm->detail[tm->active], sizeof(metrics_detail_t) );
+        }
+        __atomic_thread_fence( __ATOMIC_ACQUIRE );
+
+        if ( __atomic_load_n(&tm->seq, __ATOMIC_RELAXED) == seq1 ) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+
+// Request reset of RT thread metrics (reader side).
+// Return 0 when request is posted, 1 when previous request is still pending.
+
+int reset_metrics( thread_metrics_t *tm )
+{
+    uint32_t  ack = __atomic_load_n( &tm->reset_ack, __ATOMIC_ACQUIRE );
+
+    if ( ack != tm->reset_req ) {
+        return 1;
+    }
+    int  digits = tm->bank[tm->active].hist.digits;
+
+    init_metrics( &tm->bank[tm->active ^ 1], digits );
+    init_detail( &tm->detail[tm->active ^ 1], digits );
+    __atomic_store_n( &tm->reset_req, ack + 1, __ATOMIC_RELEASE );
+    return 0;
+}
 
-    double  max_lat_ms  = metrics->max_lat;
-            max_lat_ms /= 1000.0;
 
-    // Cumulative sum of overflow RT_PERIOD
-    double  late_sum_ms  = metrics->late_sum_us;
-            late_sum_ms /= 1000.0;
+// Accumulate "src" metrics into "dst" (aggregate of several RT threads)
 
-    printf("# Histogram: [us] [count]\n");
-    for ( int ix = 0; ix < HISTOSIZE; ix++ ) {
-        if ( metrics->histogram[ix] ) {
-            printf("%06d %06d\n", ix, metrics->histogram[ix] );
+void merge_metrics( metrics_t *dst, metrics_t *src )
+{
+    if ( !src->counter ) {
+         return;
+    }
+    if ( !dst->counter ) {
+         dst->start_ns = src->start_ns;
+         dst->stop_ns  = src->stop_ns;
+    }
+    if ( src->start_ns < dst->start_ns ) {
+         dst->start_ns = src->start_ns;
+    }
+    if ( src->stop_ns > dst->stop_ns ) {
+         dst->stop_ns = src->stop_ns;
+    }
+    hdr_merge( &dst->hist, &src->hist );
+    burst_merge( &dst->burst, &src->burst );
+    dst->missed      += src->missed;
+    dst->sum_ns      += src->sum_ns;
+    dst->counter     += src->counter;
+    dst->spin_sum_ns += src->spin_sum_ns;
+    dst->spin_miss   += src->spin_miss;
+    dst->dl_throttled += src->dl_throttled;
+    dst->dl_missed    += src->dl_missed;
+    dst->minflt       += src->minflt;
+    dst->majflt       += src->majflt;
+    dst->nivcsw       += src->nivcsw;
+    for ( int ix = 0; ix < PERF_BUCKETS; ix++ ) {
+        dst->perf[ix].samples += src->perf[ix].samples;
+        for ( int ev = 0; ev < PERF_EVENTS; ev++ ) {
+            dst->perf[ix].sum[ev] += src->perf[ix].sum[ev];
         }
     }
-    printf("#\n");
+    if ( src->fault_max_ns > dst->fault_max_ns ) {
+        dst->fault_max_ns = src->fault_max_ns;
+    }
+}
+
+
+// Accumulate response and load phase histograms of "src" into "dst"
+
+static void merge_detail( metrics_detail_t *dst, metrics_detail_t *src )
+{
+    hdr_merge( &dst->response, &src->response );
+    for ( int ix = 0; ix < LOAD_TAGS; ix++ ) {
+        hdr_merge( &dst->load[ix], &src->load[ix] );
+    }
+}
+
+
+static void print_summary( metrics_t *metrics )
+{
+    double  runtime  = (metrics->stop_ns - metrics->start_ns) / 1000.0;
+    double  rounds   = runtime / RT_PERIOD;
+
+    double  awg_ms   = metrics->sum_ns;
+            awg_ms  /= metrics->counter;
+            awg_ms  /= 1000000.0;
+
+    double  max_lat_ms  = metrics->hist.max;
+            max_lat_ms /= 1000000.0;
+
     printf("# run  time [s] = %-20.3f\n", runtime / 1000000.0 );
-    printf("# rt   counter  = %d\n",      metrics->counter );
+    printf("# rt   counter  = %ld\n",     (long)metrics->counter );
     printf("# rt   period   = %-20.3f\n", (float)RT_PERIOD / 1000.0 );
-//  printf("# max  latency  = %d\n",      metrics->max_lat );
+//  printf("# max  latency  = %ld\n",     metrics->hist.max );
     printf("# max  latency  = %-20.3f\n", max_lat_ms );
     printf("# awg  latency  = %-20.3f\n", awg_ms );
-    printf("# late count    = %d\n",      metrics->late_count );
-//  printf("# late [ms]     = %d.%03d\n", metrics->late_sum_us / 1000, metrics->late_sum_us % 1000 );
-    printf("# late sum      = %-20.3f\n", late_sum_ms );
-    printf("# hist.overflow = %d\n",      metrics->histogram[0] );
+    printf("# missed period = %ld\n",     (long)metrics->missed );
+    printf("# overrun burst = %ld",       (long)metrics->burst.total );
+    if ( metrics->burst.total ) {
+        printf(" (p50 %ld, p99 %ld, max %ld periods)", (long)burst_percentile(&metrics->burst, 50.0),
+               (long)burst_percentile(&metrics->burst, 99.0), (long)metrics->burst.max );
+    }
+    printf("\n");
+    printf("# p50   latency = %-20.3f\n", hdr_percentile(&metrics->hist, 50.0)  / 1000000.0 );
+    printf("# p99   latency = %-20.3f\n", hdr_percentile(&metrics->hist, 99.0)  / 1000000.0 );
+    printf("# p999  latency = %-20.3f\n", hdr_percentile(&metrics->hist, 99.9)  / 1000000.0 );
+    printf("# p9999 latency = %-20.3f\n", hdr_percentile(&metrics->hist, 99.99) / 1000000.0 );
+    printf("# hist.overflow = %ld\n",     (long)metrics->hist.overflow );
+    printf("# hist.underflow = %ld\n",     (long)metrics->hist.underflow );
+    if ( metrics->spin_sum_ns || metrics->spin_miss ) {
+        printf("# spin time [%%] = %-20.3f\n", 100.0 * metrics->spin_sum_ns / (runtime * 1000.0) );
+        printf("# spin miss     = %d\n",      metrics->spin_miss );
+    }
+    if ( metrics->dl_throttled || metrics->dl_missed ) {
+        printf("# dl throttled  = %d\n",      metrics->dl_throttled );
+        printf("# dl missed     = %d\n",      metrics->dl_missed );
+    }
+    printf("# page faults   = %ld minor, %ld major", (long)metrics->minflt, (long)metrics->majflt );
+    if ( metrics->minflt || metrics->majflt ) {
+        printf(" (max latency of faulting period %.3f)", metrics->fault_max_ns / 1000000.0 );
+    }
+    printf("\n");
+    printf("# invol. switch = %ld\n",     (long)metrics->nivcsw );
     printf("#\n");
 //  printf("# rounds        = %-20.3f\n", rounds );
+}
+
+
+void print_metrics( metrics_t *metrics )
+{
+    hdr_hist_t  *h = &metrics->hist;
+
+    printf("# Histogram: [ns] [count] (%d significant digits)\n", h->digits);
+    for ( int ix = 0; ix < h->counts_len; ix++ ) {
+        if ( h->counts[ix] ) {
+            printf("%010ld %06lu\n", (long)hdr_value_at(h, ix), (unsigned long)h->counts[ix] );
+        }
+    }
+    printf("#\n");
+    print_summary( metrics );
     //
     #if 0
     struct  timespec past, now;
@@ -264,10 +633,336 @@ void print_metrics( metrics_t *metrics )
     #endif
 }
 
+
+static void print_tasks( thread_metrics_t *tm, metrics_detail_t *metrics )
+{
+    if ( !tm->ntasks ) {
+        return;
+    }
+    printf("# task      period[ms]    count  lat[us] avg      max  jitter avg      max"
+           "  exec[us] min      avg      p99      max  resp[us] max  overrun   missed  mperiod\n");
+    for ( int ix = 0; ix < tm->ntasks; ix++ ) {
+        task_metrics_t  *tk = &metrics->task[ix];
+        int64_t          period = tm->task[ix].period_ns ? tm->task[ix].period_ns : tm->period_ns;
+        int64_t          n  = tk->count ? tk->count : 1;
+
+        printf("# %-12s %7.3f %8ld %12.3f %8.3f %11.3f %8.3f %12.3f %8.3f %8.3f %8.3f %13.3f %8d %8d %8d\n",
+               tm->task[ix].name, period / 1000000.0, (long)tk->count,
+               tk->lat_sum_ns / 1000.0 / n, tk->lat_max_ns / 1000.0,
+               tk->jitter_sum_ns / 1000.0 / n, tk->jitter_max_ns / 1000.0,
+               tk->exec.min / 1000.0, tk->exec_sum_ns / 1000.0 / n,
+               hdr_percentile(&tk->exec, 99.0) / 1000.0, tk->exec.max / 1000.0,
+               tk->resp_max_ns / 1000.0,
+               tk->budget_overruns, tk->deadline_misses, tk->missed_periods );
+    }
+    printf("# response [us]: p50 %.3f  p99 %.3f  max %.3f\n",
+           hdr_percentile(&metrics->response, 50.0) / 1000.0,
+           hdr_percentile(&metrics->response, 99.0) / 1000.0,
+           metrics->response.max / 1000.0 );
+    printf("#\n");
+}
+
+
+// Latency split by load phase (only when load generators have run)
+
+static void print_loads( metrics_detail_t *metrics )
+{
+    int64_t  loaded = 0;
+
+    for ( int ix = LOAD_IDLE + 1; ix < LOAD_TAGS; ix++ ) {
+        loaded += metrics->load[ix].total;
+    }
+    if ( !loaded ) {
+        return;
+    }
+    printf("# load        count  p50[us]  p99[us] p999[us]  max[us]\n");
+    for ( int ix = 0; ix < LOAD_TAGS; ix++ ) {
+        hdr_hist_t  *h = &metrics->load[ix];
+
+        if ( !h->total ) {
+            continue;
+        }
+        printf("# %-9s %8ld %8.3f %8.3f %8.3f %8.3f\n", load_name(ix), (long)h->total,
+               hdr_percentile(h, 50.0) / 1000.0, hdr_percentile(h, 99.0) / 1000.0,
+               hdr_percentile(h, 99.9) / 1000.0, h->max / 1000.0 );
+    }
+    printf("#\n");
+}
+
+
+// Average perf counter deltas per sample of each latency bucket (only
+// when RT thread had perf counters, "mask" == valid counters)
+
+static void print_perf( metrics_t *metrics, int mask )
+{
+    if ( !mask ) {
+        return;
+    }
+    printf("# latency[us] <=   count");
+    for ( int ev = 0; ev < PERF_EVENTS; ev++ ) {
+        if ( mask & (1 << ev) ) {
+            printf(" %9s", perf_name(ev) );
+        }
+    }
+    printf("   (avg per sample)\n");
+    for ( int ix = 0; ix < PERF_BUCKETS; ix++ ) {
+        perf_bucket_t  *b = &metrics->perf[ix];
+
+        if ( !b->samples ) {
+            continue;
+        }
+        printf("# %14.3f %8ld", ((int64_t)1 << ix) / 1000.0, (long)b->samples );
+        for ( int ev = 0; ev < PERF_EVENTS; ev++ ) {
+            if ( mask & (1 << ev) ) {
+                printf(" %9.3f", (double)b->sum[ev] / b->samples );
+            }
+        }
+        printf("\n");
+    }
+    printf("#\n");
+}
+
+
+// Print histogram with one column per RT thread plus total column,
+// then summary of each RT thread and summary of all threads together.
+
+void print_all_metrics( shm_metrics_t *shm )
+{
+    metrics_t         *snap, *total;
+    metrics_detail_t  *detail;
+    int                n = shm->nthreads;
+    int                mask = 0;
+
+    snap   = calloc( n + 1, sizeof(metrics_t) );
+    detail = calloc( n + 1, sizeof(metrics_detail_t) );
+    if ( !snap || !detail ) {
+        printf("ERROR: Out of memory\n");
+        free( snap );
+        free( detail );
+        return;
+    }
+    for ( int th = 0; th < n; th++ ) {
+        thread_metrics_t  *tm = &shm->thread[th];
+
+        if ( snapshot_metrics(tm, &snap[th], (tm->ntasks || tm->loads) ? &detail[th] : NULL) ) {
+            printf("WARNING: Inconsistent snapshot of thread %d\n", th);
+        }
+    }
+    if ( shm->clock_hz ) {
+        printf("# Time stamps: %s %.3f MHz, max drift %ld ns\n", shm->clock,
+               shm->clock_hz / 1e6, (long)shm->drift_ns );
+    }
+    for ( int th = 0; th < n; th++ ) {
+        if ( shm->thread[th].overrun != OVERRUN_CATCHUP ) {
+            printf("# Thread %d overrun policy: %s\n", th, overrun_name(shm->thread[th].overrun) );
+        }
+        if ( shm->thread[th].dl_runtime_ns ) {
+            printf("# Thread %d SCHED_DEADLINE runtime/deadline/period [ms] = %.3f/%.3f/%.3f\n", th,
+                   shm->thread[th].dl_runtime_ns / 1000000.0, shm->thread[th].dl_deadline_ns / 1000000.0,
+                   shm->thread[th].period_ns / 1000000.0 );
+        }
+        if ( strcmp(shm->thread[th].backend, "nanosleep") ) {
+            printf("# Thread %d timer backend: %s\n", th, shm->thread[th].backend );
+        }
+        if ( shm->thread[th].ipc[0] ) {
+            printf("# Thread %d IPC: %s\n", th, shm->thread[th].ipc );
+        }
+        if ( shm->thread[th].spin_margin_ns ) {
+            printf("# Thread %d spin margin [ms] = %.3f\n", th, shm->thread[th].spin_margin_ns / 1000000.0 );
+        }
+    }
+    if ( n == 1 ) {
+        print_metrics( &snap[0] );
+        print_tasks( &shm->thread[0], &detail[0] );
+        print_loads( &detail[0] );
+        print_perf( &snap[0], shm->thread[0].perf_mask );
+        free( snap );
+        free( detail );
+        return;
+    }
+    total = &snap[n];
+    for ( int th = 0; th < n; th++ ) {
+        merge_metrics( total, &snap[th] );
+        merge_detail( &detail[n], &detail[th] );
+    }
+
+    hdr_hist_t  *h = &total->hist;
+
+    printf("# Histogram: [ns]");
+    for ( int th = 0; th < n; th++ ) {
+        printf(" [cpu%d]", shm->thread[th].cpu );
+    }
+    printf(" [total]\n");
+    for ( int ix = 0; ix < h->counts_len; ix++ ) {
+        if ( h->counts[ix] ) {
+            printf("%010ld", (long)hdr_value_at(h, ix) );
+            for ( int th = 0; th < n; th++ ) {
+                printf(" %06lu", (unsigned long)snap[th].hist.counts[ix] );
+            }
+            printf(" %06lu\n", (unsigned long)h->counts[ix] );
+        }
+    }
+    printf("#\n");
+    for ( int th = 0; th < n; th++ ) {
+        printf("# Thread %d (cpu %d):\n", th, shm->thread[th].cpu );
+        print_summary( &snap[th] );
+        print_tasks( &shm->thread[th], &detail[th] );
+        print_loads( &detail[th] );
+        print_perf( &snap[th], shm->thread[th].perf_mask );
+        mask |= shm->thread[th].perf_mask;
+    }
+    printf("# Total (%d threads):\n", n );
+    print_summary( total );
+    print_loads( &detail[n] );
+    print_perf( total, mask );
+    free( snap );
+    free( detail );
+}
+
+// Print one watch line from interval histogram "h"
+
+static void print_interval( double time_s, char *label, hdr_hist_t *h, int64_t sum_ns,
+                            int64_t faults, int64_t nivcsw )
+{
+    static double  pct[4] = { 50.0, 99.0, 99.9, 99.99 };
+    int64_t        value[4];
+
+    hdr_percentiles( h, pct, value, 4 );
+    printf("%9.1f %6s %8ld %8.3f %8.3f %8.3f %8.3f %8.3f %8.3f %9.3f %6ld %6ld\n", time_s, label,
+           (long)h->total, h->min / 1000.0, h->total ? sum_ns / 1000.0 / h->total : 0.0, h->max / 1000.0,
+           value[0] / 1000.0, value[1] / 1000.0, value[2] / 1000.0, value[3] / 1000.0,
+           (long)faults, (long)nivcsw );
+}
+
+
+// Refresh every "interval_ms": statistics of values recorded during the
+// interval, from histogram deltas of consecutive snapshots. Reset (bank
+// swap) between snapshots restarts deltas from empty histogram.
+
+void watch_metrics( shm_metrics_t *shm, int interval_ms )
+{
+    int              n     = shm->nthreads;
+    metrics_t       *cur   = calloc( n, sizeof(metrics_t) );
+    metrics_t       *prev  = calloc( n, sizeof(metrics_t) );
+    hdr_hist_t      *delta = malloc( sizeof(hdr_hist_t) );
+    hdr_hist_t      *total = malloc( sizeof(hdr_hist_t) );
+    uint32_t         ack[MAX_RT_THREADS];
+    struct timespec  interval = ns2ts( interval_ms * 1000000LL );
+    int64_t          start_ns = clock_ns( CLOCK_MONOTONIC );
+
+    if ( !cur || !prev || !delta || !total ) {
+        printf("ERROR: Out of memory\n");
+        return;
+    }
+    for ( int th = 0; th < n; th++ ) {
+        ack[th] = __atomic_load_n( &shm->thread[th].reset_ack, __ATOMIC_ACQUIRE );
+        snapshot_metrics( &shm->thread[th], &prev[th], NULL );
+    }
+    for ( int line = 0; ; line++ ) {
+        double   time_s;
+        int64_t  sum_ns = 0, faults = 0, nivcsw = 0;
+
+        nanosleep( &interval, NULL );
+        time_s = (clock_ns(CLOCK_MONOTONIC) - start_ns) / 1e9;
+        if ( line % 20 == 0 ) {
+            printf("#  time[s] thread    count  min[us]  avg[us]  max[us]  p50[us]  p99[us] p999[us] p9999[us] faults ivcsw\n");
+        }
+        memset( total, 0, sizeof(hdr_hist_t) );
+        for ( int th = 0; th < n; th++ ) {
+            thread_metrics_t  *tm = &shm->thread[th];
+            uint32_t           a  = __atomic_load_n( &tm->reset_ack, __ATOMIC_ACQUIRE );
+            char               label[16];
+
+            snapshot_metrics( tm, &cur[th], NULL );
+            if ( (a != ack[th]) || (cur[th].counter < prev[th].counter) ) {
+                init_metrics( &prev[th], cur[th].hist.digits );
+                ack[th] = a;
+            }
+            hdr_delta( delta, &cur[th].hist, &prev[th].hist );
+            hdr_merge( total, delta );
+            sum_ns += cur[th].sum_ns - prev[th].sum_ns;
+
+            int64_t  f = cur[th].minflt + cur[th].majflt - prev[th].minflt - prev[th].majflt;
+            int64_t  c = cur[th].nivcsw - prev[th].nivcsw;
+
+            faults += f;
+            nivcsw += c;
+            snprintf( label, sizeof(label), "%d", th );
+            print_interval( time_s, label, delta, cur[th].sum_ns - prev[th].sum_ns, f, c );
+            memcpy( &prev[th], &cur[th], sizeof(metrics_t) );
+        }
+        if ( n > 1 ) {
+            print_interval( time_s, "all", total, sum_ns, faults, nivcsw );
+        }
+        fflush( stdout );
+    }
+}
+
+
+// Write consistent snapshot of all RT threads to dump file "path" (input
+// of hragg). File is written as "<path>.tmp" and renamed, so readers never
+// see partial dump. Return 0 on success.
+
+int dump_metrics( shm_metrics_t *shm, char *path )
+{
+    size_t          size = SHM_METRICS_SIZE( shm->nthreads );
+    shm_metrics_t  *copy = calloc( 1, size );
+    char            tmp[512];
+    FILE           *f;
+    int             status = 0;
+
+    if ( !copy ) {
+        printf("ERROR: Out of memory\n");
+        return -1;
+    }
+    memcpy( copy, shm, sizeof(shm_metrics_t) );
+    for ( int th = 0; th < shm->nthreads; th++ ) {
+        thread_metrics_t  *tm = &copy->thread[th];
+
+        // Configuration of thread, seqlock and reset state start from zero
+        memcpy( tm, &shm->thread[th], offsetof(thread_metrics_t, bank) );
+        tm->seq       = 0;
+        tm->active    = 0;
+        tm->reset_ack = 0;
+        tm->reset_req = 0;
+        tm->flagPRINT = 0;
+        if ( snapshot_metrics(&shm->thread[th], &tm->bank[0], &tm->detail[0]) ) {
+            printf("WARNING: Inconsistent snapshot of thread %d\n", th);
+        }
+    }
+
+    snprintf( tmp, sizeof(tmp), "%s.tmp", path );
+    f = fopen( tmp, "w" );
+    if ( !f ) {
+        perror( tmp );
+        free( copy );
+        return -1;
+    }
+    if ( (fwrite(copy, size, 1, f) != 1) | fclose(f) ) {
+        perror( tmp );
+        unlink( tmp );
+        status = -1;
+    }
+    else if ( rename(tmp, path) ) {
+        perror( path );
+        status = -1;
+    }
+    free( copy );
+    return status;
+}
+
 //---------------------------------------------------------------------------
 
+// Create shared memory (writer side). Size is rounded up to huge page,
+// segment is backed by transparent huge pages (shmem_enabled "advise" or
+// "always") and locked, so RT threads take no TLB misses or page faults.
+
+#define HUGE_PAGE  (2 << 20)
+
 void *shmOpen( char *txt, char *shmName, size_t shmSize )
 {
+    shmSize = (shmSize + HUGE_PAGE - 1) & ~(size_t)(HUGE_PAGE - 1);
+
     int  fd = shm_open(shmName, O_CREAT | O_RDWR, S_IRWXU | S_IRWXG);
     if ( fd <= 0 ) {
         printf("ERROR: Open shared memory: %s\n", shmName);
@@ -279,11 +974,46 @@ void *shmOpen( char *txt, char *shmName, size_t shmSize )
         exit( 1 );
     }
     void *pMem = mmap(0, shmSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    if ( !pMem ) {
+    if ( pMem == MAP_FAILED ) {
         printf("- ERROR: mmap size=%d\n", shmSize);
         exit( 1 );
     }
     close(fd);
+    if ( madvise(pMem, shmSize, MADV_HUGEPAGE) ) {
+        perror("- WARNING: madvise(MADV_HUGEPAGE)");
+    }
+    if ( mlock(pMem, shmSize) ) {
+        perror("- WARNING: mlock");
+    }
+    prefault( pMem, shmSize );
+    return pMem;
+}
+
+
+// Map existing shared memory without changing its size (reader side)
+
+void *shmAttach( char *txt, char *shmName, size_t *shmSize )
+{
+    struct stat  st;
+
+    int  fd = shm_open(shmName, O_RDWR, 0);
+    if ( fd < 0 ) {
+        printf("ERROR: Shared memory %s does not exist (RT application not started?)\n", shmName);
+        return NULL;
+    }
+    printf("Shared Memory %s (fd=%d) %s\n", txt, fd, shmName);
+    if ( fstat(fd, &st) != 0 ) {
+        printf("- ERROR: fstat\n");
+        close(fd);
+        return NULL;
+    }
+    void *pMem = mmap(0, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if ( pMem == MAP_FAILED ) {
+        printf("- ERROR: mmap size=%ld\n", (long)st.st_size);
+        return NULL;
+    }
+    *shmSize = st.st_size;
     return pMem;
 }
 
@@ -13,23 +13,145 @@ extern "C" {
 #endif
 
 
-#define HISTOSIZE  5001
+#include <time.h>
+#include <sys/resource.h>   // struct rusage
+#include "histogram.h"
+#include "task.h"
+#include "loadgen.h"
+#include "perf.h"
+
+#define MAX_RT_THREADS  64
+#define NSEC_PER_SEC    1000000000LL
+
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE  6
+#endif
+
+// Overrun burst lengths [periods]: bursts are a few periods long, linear
+// buckets are enough (and keep metrics bank small)
+
+#define BURST_BUCKETS   64          // count[n] == bursts of n periods
 
 typedef struct  {
-    int      reset;     // Write non zero value resets metrics
+    int64_t     total;        // Count of bursts
+    int64_t     max;          // Longest burst
+    uint32_t    over;         // Bursts of >= BURST_BUCKETS periods
+    uint32_t    count[BURST_BUCKETS];
+} burst_hist_t;
+
+// One metrics bank. Counters written every period share first cache line,
+// rarely written values and histograms (each header in own line) follow.
+// Bank is what every reader copies (print, watch, export, hragg), so it is
+// kept small: task and load phase histograms are in metrics_detail_t.
+
+typedef struct  {
+    int64_t     sum_ns;
+    int64_t     stop_ns;      // CLOCK_MONOTONIC [ns]
+    int64_t     missed;       // Missed periods (see overrun policy in task.h)
+    int64_t     spin_sum_ns;  // Hybrid sleep: busy wait time before deadlines
+    int64_t     counter;      // Samples (64 bit: merged fleet totals never wrap)
+    int         spin_miss;    // Hybrid sleep: woke up after deadline
+    int         dl_throttled; // SCHED_DEADLINE: runtime overruns (SIGXCPU)
+    int         dl_missed;    // SCHED_DEADLINE: job done after deadline
+    int         minflt;       // Minor page faults of RT thread (RUSAGE_THREAD)
+    int         majflt;       // Major page faults of RT thread
+    int         nivcsw;       // Involuntary context switches of RT thread
     //
-    int      histogram[HISTOSIZE];
-    int      late_sum_us;
-    int      late_count;
-    int      max_lat;
-    int64_t  sum_us;
-    int      counter;
+    int64_t     start_ns;     // CLOCK_MONOTONIC [ns]
+    int64_t     fault_max_ns; // Max latency of periods with page faults
     //
-    struct timespec start, stop;
+    hdr_hist_t  hist;         // Latency histogram [ns]
+    burst_hist_t   burst;     // Overrun burst length [periods]
+    perf_bucket_t  perf[PERF_BUCKETS];  // Perf counter deltas by latency bucket
 } metrics_t;
 
+// Detail of one bank: periodic tasks (-x) and latency split by load phase
+// (-L). RT thread writes it only when they are configured, readers copy it
+// only when they print it.
+
+typedef struct  {
+    hdr_hist_t      response;         // Release -> all tasks done [ns]
+    task_metrics_t  task[MAX_TASKS];  // Periodic application tasks
+    hdr_hist_t      load[LOAD_TAGS];  // Latency [ns] split by load phase
+} metrics_detail_t;
+
+// One measurement of RT thread
+
+typedef struct  {
+    int64_t     latency_ns;   // Wake up latency
+    int64_t     now_ns;       // Wake up time, CLOCK_MONOTONIC
+    int64_t     spin_ns;      // Hybrid sleep: busy wait time before deadline
+    int         spin_miss;    // Hybrid sleep: woke up after deadline
+    int         dl_throttled; // SCHED_DEADLINE: runtime overruns since previous sample
+    int         dl_miss;      // SCHED_DEADLINE: job done after deadline
+    int         load;         // Load phase (LOAD_IDLE ...)
+    int         minflt;       // Minor page faults since previous sample
+    int         majflt;       // Major page faults since previous sample
+    int         nivcsw;       // Involuntary context switches since previous sample
+    int         perf_mask;    // Valid perf counters (0 == no perf, see perf.h)
+    int32_t     perf[PERF_EVENTS];  // Perf counter deltas since previous sample
+    task_sample_t  tasks;     // Execution of periodic application tasks
+} sample_t;
+
+// Metrics of one RT thread.
+//
+// RT thread updates only bank[active] and keeps "seq" odd while update is
+// in progress (seqlock), readers retry copy until "seq" is even and stable.
+// Reset: reader clears inactive bank and increments "reset_req", RT thread
+// swaps banks and writes "reset_ack". No memset() in RT thread.
+//
+// Layout: RT thread control, reader control and configuration (written
+// before RT thread starts) are in own cache lines, so reader writes never
+// invalidate lines RT thread writes.
+
+typedef struct  {
+    uint32_t   seq;          // Seqlock sequence, odd == update in progress
+    int        active;       // Bank index RT thread writes
+    uint32_t   reset_ack;    // RT thread: last acknowledged reset epoch
+    int        flagPRINT;    // RT thread private state of update_metrics()
+    //
+    uint32_t   reset_req __attribute__((aligned(CACHE_LINE)));   // Reader: reset request epoch
+    //
+    int        cpu __attribute__((aligned(CACHE_LINE)));  // CPU where RT thread is pinned (-1 == not pinned)
+    int64_t    spin_margin_ns;  // Hybrid sleep: wake up this much before deadline
+    int64_t    period_ns;       // RT period
+    char       backend[16];     // Timer backend name
+    char       ipc[32];         // IPC ping-pong: primitive, latency, placement ("" == timer)
+    int        perf_mask;       // Perf counters RT thread has opened (see perf.h)
+    int        overrun;         // Overrun policy (OVERRUN_...)
+    int64_t    dl_runtime_ns;   // SCHED_DEADLINE runtime (0 == other policy)
+    int64_t    dl_deadline_ns;  // SCHED_DEADLINE relative deadline
+    int        ntasks;          // Periodic application tasks
+    int        loads;           // Load generators run (latency split by load phase)
+    task_config_t  task[MAX_TASKS];
+    //
+    metrics_t  bank[2];
+    metrics_detail_t  detail[2];    // Detail of each bank
+} thread_metrics_t;
+
+// Shared memory layout: header followed by one metrics block per RT thread.
+// Dump file (hrtimer -d) has same layout with snapshot of each thread in
+// bank 0, so hragg reads segments and dumps alike.
+
+#define SHM_MAGIC  0x31545248       // "HRT1": metrics segment or dump file
+
+typedef struct  {
+    uint32_t          magic;       // SHM_MAGIC
+    int               nthreads;    // Number of valid metrics blocks in "thread[]"
+    int               size;        // sizeof(thread_metrics_t) of writer (sanity check)
+    char              clock[16];   // Time stamp source
+    int64_t           clock_hz;    // Cycle counter frequency (0 == clock_gettime)
+    int64_t           drift_ns;    // Max cycle counter drift against CLOCK_MONOTONIC
+    thread_metrics_t  thread[];
+} shm_metrics_t;
+
+#define SHM_METRICS_SIZE(n)  (sizeof(shm_metrics_t) + (n) * sizeof(thread_metrics_t))
+
 void check_root( void );
 void lock_memory( void );
+void prefault( void *addr, size_t size );
+void thread_rusage( struct rusage *prev, sample_t *sample );
+int  set_sched_deadline( int64_t runtime_ns, int64_t deadline_ns, int64_t period_ns );
 
 int64_t         tsDiffus( struct timespec start, struct timespec end );
 struct timespec  tsDiff(  struct timespec start, struct timespec end );
@@ -37,10 +159,61 @@ struct timespec  tsAddus( struct timespec timestamp, int us );
 struct timespec  tsSubus( struct timespec timestamp, int us );
 int64_t            ts2us( struct timespec timestamp );
 
-void update_metrics( metrics_t *metrics, int latency_us, struct timespec now );
+//---------------------------------------------------------------------------
+// Integer nanosecond time core (no division in RT loop)
+
+static inline int64_t ts2ns( struct timespec ts )
+{
+    return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+
+// Division free conversion ("ns" must be >= 0): (ns >> 30) never overestimates
+// seconds, remainder is refined until it is less than one second.
+
+static inline struct timespec ns2ts( int64_t ns )
+{
+    struct timespec  ts;
+    int64_t          sec = 0;
+
+    while ( ns >= NSEC_PER_SEC ) {
+        int64_t  s = ns >> 30;
+
+        if ( !s ) {
+            s = 1;
+        }
+        sec += s;
+        ns  -= s * NSEC_PER_SEC;
+    }
+    ts.tv_sec  = sec;
+    ts.tv_nsec = ns;
+    return ts;
+}
+
+
+static inline int64_t clock_ns( clockid_t clock )
+{
+    struct timespec  ts;
+
+    clock_gettime( clock, &ts );
+    return ts2ns( ts );
+}
+
+//---------------------------------------------------------------------------
+
+void init_metrics(     metrics_t *metrics, int digits );
+void init_detail(      metrics_detail_t *detail, int digits );
+int  update_metrics(   thread_metrics_t *tm, sample_t *sample );
+int  snapshot_metrics( thread_metrics_t *tm, metrics_t *copy, metrics_detail_t *detail );
+int  reset_metrics(    thread_metrics_t *tm );
+void merge_metrics(    metrics_t *dst, metrics_t *src );
 void print_metrics(  metrics_t *metrics );
+void print_all_metrics( shm_metrics_t *shm );
+void watch_metrics( shm_metrics_t *shm, int interval_ms );
+int  dump_metrics(  shm_metrics_t *shm, char *path );
 
-void *shmOpen( char *txt, char *shmName, size_t shmSize );
+void *shmOpen(   char *txt, char *shmName, size_t shmSize );
+void *shmAttach( char *txt, char *shmName, size_t *shmSize );
 
 char *InitCOM( int hSerial, int speed, int parity );
 int   set_interface_attribs (int fd, int speed, int parity);
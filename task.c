@@ -0,0 +1,261 @@
+//
+// File:  task.c
+//
+// Periodic application tasks of RT threads (cyclic executive)
+//
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "suppfunc.h"
+#include "task.h"
+#include "tsc.h"
+
+typedef struct  {
+    task_func_t    func;
+    void          *ctx;
+    task_config_t  config;
+    int64_t        period_ns;       // Effective period
+    int64_t        next_ns;         // Next release
+    int64_t        last_start_ns;   // Previous start (jitter), 0 == none
+    int            burst;           // Catchup: back to back late releases
+} task_t;
+
+typedef struct  {
+    int            ntasks;
+    task_t         task[MAX_TASKS];
+    task_t         base;            // RT period releases (thread without tasks)
+    int            policy;          // Overrun policy
+    int            nheap;
+    int            heap[MAX_TASKS]; // Task indexes, min-heap by next release
+} task_table_t;
+
+static task_table_t  tables[MAX_RT_THREADS];
+
+//---------------------------------------------------------------------------
+// Release heap: earliest release first, shorter period first on same time
+
+static int before( task_table_t *tt, int a, int b )
+{
+    task_t  *ta = &tt->task[a];
+    task_t  *tb = &tt->task[b];
+
+    if ( ta->next_ns != tb->next_ns ) {
+        return ta->next_ns < tb->next_ns;
+    }
+    return ta->period_ns < tb->period_ns;
+}
+
+
+static void heap_push( task_table_t *tt, int task )
+{
+    int  ix = tt->nheap++;
+
+    while ( ix > 0 ) {
+        int  parent = (ix - 1) / 2;
+
+        if ( !before(tt, task, tt->heap[parent]) ) {
+            break;
+        }
+        tt->heap[ix] = tt->heap[parent];
+        ix = parent;
+    }
+    tt->heap[ix] = task;
+}
+
+
+static int heap_pop( task_table_t *tt )
+{
+    int  top  = tt->heap[0];
+    int  last = tt->heap[--tt->nheap];
+    int  ix   = 0;
+
+    for ( ;; ) {
+        int  child = 2 * ix + 1;
+
+        if ( child >= tt->nheap ) {
+            break;
+        }
+        if ( (child + 1 < tt->nheap) && before(tt, tt->heap[child+1], tt->heap[child]) ) {
+            child++;
+        }
+        if ( !before(tt, tt->heap[child], last) ) {
+            break;
+        }
+        tt->heap[ix] = tt->heap[child];
+        ix = child;
+    }
+    tt->heap[ix] = last;
+    return top;
+}
+
+//---------------------------------------------------------------------------
+
+// Apply overrun policy to task whose release has just run ("now_ns" == end
+// of run, "next_ns" already advanced by one period). Return count of missed
+// periods, "*burst" = length of finished overrun burst [periods].
+
+static int overrun( task_table_t *tt, task_t *t, int64_t now_ns, int *burst )
+{
+    int  missed;
+
+    *burst = 0;
+    if ( t->next_ns > now_ns ) {
+        // On time: catchup burst (if any) is over
+        *burst   = t->burst;
+        t->burst = 0;
+        return 0;
+    }
+    missed = (now_ns - t->next_ns) / t->period_ns + 1;
+
+    switch ( tt->policy ) {
+        case OVERRUN_SKIP:
+            t->next_ns += missed * t->period_ns;
+            *burst      = missed;
+            return missed;
+        case OVERRUN_REPHASE:
+            t->next_ns  = now_ns + t->period_ns;
+            *burst      = missed;
+            return missed;
+        default:
+            // Catchup: next release runs late, count it when it runs
+            t->burst++;
+            return 1;
+    }
+}
+
+//---------------------------------------------------------------------------
+
+// Register task to RT thread "thread". Call before RT threads are started.
+// Return task index, -1 on error.
+
+int task_register( int thread, char *name, task_func_t func, void *ctx,
+                   int64_t period_ns, int64_t phase_ns,
+                   int64_t budget_ns, int64_t deadline_ns )
+{
+    if ( (thread < 0) || (thread >= MAX_RT_THREADS) ) {
+        printf("ERROR: Task %s: invalid thread %d\n", name, thread);
+        return -1;
+    }
+    task_table_t  *tt = &tables[thread];
+
+    if ( tt->ntasks >= MAX_TASKS ) {
+        printf("ERROR: Task %s: max %d tasks per thread\n", name, MAX_TASKS);
+        return -1;
+    }
+    task_t  *t = &tt->task[tt->ntasks];
+
+    t->func = func;
+    t->ctx  = ctx;
+    strncpy( t->config.name, name, TASK_NAME_LEN - 1 );
+    t->config.period_ns   = period_ns;
+    t->config.phase_ns    = phase_ns;
+    t->config.budget_ns   = budget_ns;
+    t->config.deadline_ns = deadline_ns;
+    return tt->ntasks++;
+}
+
+
+// Copy task configuration of thread to "config[MAX_TASKS]", return count of tasks
+
+int task_config( int thread, task_config_t *config )
+{
+    task_table_t  *tt = &tables[thread];
+
+    for ( int ix = 0; ix < tt->ntasks; ix++ ) {
+        config[ix] = tt->task[ix].config;
+    }
+    return tt->ntasks;
+}
+
+
+int overrun_policy( char *name )
+{
+    if ( !strcmp(name, "catchup") )  return OVERRUN_CATCHUP;
+    if ( !strcmp(name, "skip")    )  return OVERRUN_SKIP;
+    if ( !strcmp(name, "rephase") )  return OVERRUN_REPHASE;
+    return -1;
+}
+
+
+char *overrun_name( int policy )
+{
+    switch ( policy ) {
+        case OVERRUN_SKIP:     return "skip";
+        case OVERRUN_REPHASE:  return "rephase";
+        default:               return "catchup";
+    }
+}
+
+
+// RT thread: set first releases. Return first wake up time.
+
+int64_t tasks_start( int thread, int64_t start_ns, int64_t period_ns, int policy )
+{
+    task_table_t  *tt = &tables[thread];
+
+    tt->policy         = policy;
+    tt->nheap          = 0;
+    tt->base.period_ns = period_ns;
+    tt->base.next_ns   = start_ns + period_ns;
+    tt->base.burst     = 0;
+    if ( !tt->ntasks ) {
+        return tt->base.next_ns;
+    }
+    for ( int ix = 0; ix < tt->ntasks; ix++ ) {
+        task_t  *t = &tt->task[ix];
+
+        t->period_ns     = t->config.period_ns ? t->config.period_ns : period_ns;
+        t->next_ns       = start_ns + t->period_ns + t->config.phase_ns;
+        t->last_start_ns = 0;
+        t->burst         = 0;
+        heap_push( tt, ix );
+    }
+    return tt->task[ tt->heap[0] ].next_ns;
+}
+
+
+// RT thread: run tasks released at "wake_ns", measure them and apply
+// overrun policy. Return next wake up time (next release).
+
+int64_t run_tasks( int thread, int64_t wake_ns, task_sample_t *sample )
+{
+    task_table_t  *tt = &tables[thread];
+    int64_t        t0 = tsc_ns();
+
+    sample->ntasks   = tt->ntasks;
+    sample->released = 0;
+    if ( !tt->ntasks ) {
+        tt->base.next_ns += tt->base.period_ns;
+        sample->missed[0] = overrun( tt, &tt->base, t0, &sample->burst[0] );
+        return tt->base.next_ns;
+    }
+    while ( tt->task[ tt->heap[0] ].next_ns <= wake_ns ) {
+        int      ix = heap_pop( tt );
+        task_t  *t  = &tt->task[ix];
+
+        t->func( t->ctx );
+
+        int64_t  t1 = tsc_ns();
+
+        sample->released      |= 1 << ix;
+        sample->release_ns[ix] = t->next_ns;
+        sample->start_ns[ix]   = t0;
+        sample->jitter_ns[ix]  = -1;
+        if ( t->last_start_ns ) {
+            int64_t  jitter = (t0 - t->last_start_ns) - t->period_ns;
+
+            sample->jitter_ns[ix] = (jitter < 0) ? -jitter : jitter;
+        }
+        sample->exec_ns[ix] = t1 - t0;
+        sample->done_ns[ix] = t1;
+
+        t->last_start_ns = t0;
+        t->next_ns      += t->period_ns;
+        sample->missed[ix] = overrun( tt, t, t1, &sample->burst[ix] );
+        heap_push( tt, ix );
+        t0 = t1;
+    }
+    return tt->task[ tt->heap[0] ].next_ns;
+}
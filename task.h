@@ -0,0 +1,104 @@
+//
+// File:  task.h
+//
+// Periodic application tasks of RT threads (cyclic executive)
+//
+// Application registers task callbacks (with own context) to RT thread
+// before RT threads are started. Each task has own period and phase
+// (period 0 == RT period). RT thread keeps releases of its tasks in
+// min-heap and sleeps until next release, so one thread serves several
+// rates. Tasks released at same time run in rate monotonic order
+// (shortest period first).
+//
+// update_metrics() records release latency, jitter, execution and response
+// (release -> task done) times and checks budget and deadline overruns.
+//
+// Overrun policy: when release has run and next release of same task is
+// already due (thread woke up late or task ran too long):
+//
+//      catchup   run missed releases back to back (burst of late releases)
+//      skip      drop missed releases, keep phase
+//      rephase   drop missed releases, next release one period from now
+//
+// Each missed period is counted, burst length [periods] of each overrun
+// (catchup: count of back to back late releases) goes to histogram.
+//
+
+#ifndef  TASK_H
+#define  TASK_H
+
+#include <stdint.h>
+#include "histogram.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#define MAX_TASKS       8
+#define TASK_NAME_LEN   16
+
+#define OVERRUN_CATCHUP  0
+#define OVERRUN_SKIP     1
+#define OVERRUN_REPHASE  2
+
+typedef void (*task_func_t)( void *ctx );
+
+// Task configuration (copy in shared memory for readers)
+
+typedef struct  {
+    char         name[TASK_NAME_LEN];
+    int64_t      period_ns;       // Release period, 0 == RT period
+    int64_t      phase_ns;        // Release offset from RT thread start
+    int64_t      budget_ns;       // Max execution time, 0 == not checked
+    int64_t      deadline_ns;     // Max response time from release, 0 == period
+} task_config_t;
+
+// Task metrics (in each metrics bank)
+
+typedef struct  {
+    hdr_hist_t   exec;            // Execution time histogram [ns]
+    int64_t      exec_sum_ns;
+    int64_t      lat_min_ns;      // Release latency: release -> task start
+    int64_t      lat_max_ns;
+    int64_t      lat_sum_ns;
+    int64_t      jitter_max_ns;   // |start interval - period|
+    int64_t      jitter_sum_ns;
+    int64_t      resp_min_ns;     // Response time: release -> task done
+    int64_t      resp_max_ns;
+    int64_t      resp_sum_ns;
+    int64_t      count;
+    int          budget_overruns;
+    int          deadline_misses;
+    int          missed_periods;  // See overrun policy
+} task_metrics_t;
+
+// Execution results of one RT thread wake up (see sample_t)
+
+typedef struct  {
+    int          ntasks;
+    uint32_t     released;        // Bit mask of tasks run at this wake up
+    int64_t      release_ns[MAX_TASKS];
+    int64_t      start_ns[MAX_TASKS];
+    int64_t      jitter_ns[MAX_TASKS];   // -1 == first release
+    int64_t      exec_ns[MAX_TASKS];
+    int64_t      done_ns[MAX_TASKS];
+    int          missed[MAX_TASKS];  // Missed periods ([0] == RT period without tasks)
+    int          burst[MAX_TASKS];   // Length of finished overrun burst, 0 == none
+} task_sample_t;
+
+
+int      task_register( int thread, char *name, task_func_t func, void *ctx,
+                        int64_t period_ns, int64_t phase_ns,
+                        int64_t budget_ns, int64_t deadline_ns );
+int      task_config( int thread, task_config_t *config );
+int      overrun_policy( char *name );
+char    *overrun_name( int policy );
+int64_t  tasks_start( int thread, int64_t start_ns, int64_t period_ns, int policy );
+int64_t  run_tasks( int thread, int64_t wake_ns, task_sample_t *sample );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TASK_H
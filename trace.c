@@ -0,0 +1,152 @@
+//
+// File:  trace.c
+//
+// Streaming binary per-sample trace recording, flush thread side
+//
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "suppfunc.h"
+#include "trace.h"
+
+static trace_ring_t  *rings;
+static int            ring_count;
+static size_t         rings_size;
+static int64_t        trace_period_ns;
+
+static char           ring_name[128];      // Shared memory name of rings
+static char          *trace_path;
+static int            trace_fd = -1;
+static int            trace_rotation;       // Count of rotated files
+static int64_t        trace_bytes;          // Bytes written to current file
+static int64_t        trace_limit;          // Rotate size [bytes], 0 == never
+
+//---------------------------------------------------------------------------
+
+static int open_file( void )
+{
+    trace_header_t  hdr;
+
+    trace_fd = open( trace_path, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+    if ( trace_fd < 0 ) {
+        printf("ERROR: Open trace file: %s\n", trace_path);
+        return -1;
+    }
+    memset( &hdr, 0, sizeof(hdr) );
+    hdr.magic       = TRACE_MAGIC;
+    hdr.version     = TRACE_VERSION;
+    hdr.record_size = sizeof(trace_rec_t);
+    hdr.nthreads    = ring_count;
+    hdr.period_ns   = trace_period_ns;
+    hdr.start_ns    = clock_ns( CLOCK_MONOTONIC );
+
+    if ( write(trace_fd, &hdr, sizeof(hdr)) != sizeof(hdr) ) {
+        printf("ERROR: Write trace file: %s\n", trace_path);
+        return -1;
+    }
+    trace_bytes = sizeof(hdr);
+    return 0;
+}
+
+
+// Rename current file to "<path>.<n>" and start new one
+
+static int rotate_file( void )
+{
+    char  name[512];
+
+    close( trace_fd );
+    trace_rotation++;
+    snprintf( name, sizeof(name), "%s.%d", trace_path, trace_rotation );
+    if ( rename(trace_path, name) ) {
+        printf("WARNING: Rename trace file %s -> %s\n", trace_path, name);
+    }
+    return open_file();
+}
+
+//---------------------------------------------------------------------------
+
+trace_ring_t *trace_open( char *shm_name, char *path, int nthreads, int64_t period_ns, int rotate_mb )
+{
+    snprintf( ring_name, sizeof(ring_name), "%s" SHM_TRACE, shm_name );
+    rings_size      = nthreads * sizeof(trace_ring_t);
+    rings           = shmOpen( "(trace)", ring_name, rings_size );
+    ring_count      = nthreads;
+    trace_period_ns = period_ns;
+    trace_path      = path;
+    trace_limit     = (int64_t)rotate_mb << 20;
+
+    memset( rings, 0, rings_size );
+    if ( open_file() ) {
+        return NULL;
+    }
+    return rings;
+}
+
+
+// Copy new records of each ring to trace file.
+// Return count of records written, -1 on write error.
+
+int trace_flush( void )
+{
+    int  count = 0;
+
+    if ( trace_fd < 0 ) {
+        return 0;
+    }
+    for ( int th = 0; th < ring_count; th++ ) {
+        trace_ring_t  *r    = &rings[th];
+        uint32_t       tail = r->tail;
+        uint32_t       head = __atomic_load_n( &r->head, __ATOMIC_ACQUIRE );
+
+        while ( head != tail ) {
+            // Write contiguous part of ring (up to wrap around point)
+            uint32_t  ix = tail & (TRACE_RING_SIZE - 1);
+            uint32_t  n  = head - tail;
+
+            if ( n > TRACE_RING_SIZE - ix ) {
+                n = TRACE_RING_SIZE - ix;
+            }
+            ssize_t  len = n * sizeof(trace_rec_t);
+
+            if ( write(trace_fd, &r->rec[ix], len) != len ) {
+                printf("ERROR: Write trace file: %s\n", trace_path);
+                return -1;
+            }
+            tail        += n;
+            count       += n;
+            trace_bytes += len;
+            __atomic_store_n( &r->tail, tail, __ATOMIC_RELEASE );
+        }
+    }
+    if ( trace_limit && (trace_bytes >= trace_limit) ) {
+        if ( rotate_file() ) {
+            return -1;
+        }
+    }
+    return count;
+}
+
+
+void trace_close( void )
+{
+    trace_flush();
+    for ( int th = 0; th < ring_count; th++ ) {
+        if ( rings[th].dropped ) {
+            printf("WARNING: Trace of thread %d dropped %u records\n", th, rings[th].dropped);
+        }
+    }
+    if ( trace_fd >= 0 ) {
+        close( trace_fd );
+        trace_fd = -1;
+    }
+    munmap( rings, rings_size );
+    shm_unlink( ring_name );
+}
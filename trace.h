@@ -0,0 +1,84 @@
+//
+// File:  trace.h
+//
+// Streaming binary per-sample trace recording
+//
+// Each RT thread appends fixed size records to own ring in memory mapped
+// file /dev/shm/RT_METRICS_TRACE (no system calls in RT thread). Low priority
+// thread flushes rings to trace file and rotates file when it grows over
+// size limit. Full ring drops records (see "seq" gaps in trace file).
+//
+// Trace file: trace_header_t followed by trace_rec_t records. Decoder: hrtrace
+//
+
+#ifndef  TRACE_H
+#define  TRACE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#define SHM_TRACE          "_TRACE"        // Shared memory name of rings: metrics name + suffix
+#define TRACE_MAGIC        0x52545248      // "HRTR"
+#define TRACE_VERSION      1
+#define TRACE_RING_SIZE    16384           // Records per RT thread, power of two
+
+typedef struct  {
+    int64_t   wake_ns;        // Wake up time, CLOCK_MONOTONIC [ns]
+    uint32_t  seq;            // Sample sequence number of RT thread
+    int32_t   latency_ns;     // Saturated to INT32_MAX
+    uint16_t  cpu;            // CPU of RT thread (0xffff == not pinned)
+    uint16_t  thread;         // RT thread number
+} trace_rec_t;
+
+typedef struct  {
+    uint32_t  magic;
+    uint32_t  version;
+    uint32_t  record_size;    // sizeof(trace_rec_t)
+    uint32_t  nthreads;
+    int64_t   period_ns;
+    int64_t   start_ns;       // CLOCK_MONOTONIC when file was opened
+} trace_header_t;
+
+typedef struct  {
+    uint32_t     head  __attribute__((aligned(64)));    // RT thread
+    uint32_t     dropped;                               // RT thread
+    uint32_t     tail  __attribute__((aligned(64)));    // Flush thread
+    trace_rec_t  rec[TRACE_RING_SIZE] __attribute__((aligned(64)));
+} trace_ring_t;
+
+
+trace_ring_t *trace_open( char *shm_name, char *path, int nthreads, int64_t period_ns, int rotate_mb );
+int           trace_flush( void );
+void          trace_close( void );
+
+
+// RT thread side: no system calls, drop record when ring is full
+
+static inline void trace_push( trace_ring_t *r, uint32_t seq, int thread, int cpu,
+                               int64_t wake_ns, int64_t latency_ns )
+{
+    uint32_t      head = r->head;
+    trace_rec_t  *rec;
+
+    if ( head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >= TRACE_RING_SIZE ) {
+        __atomic_store_n( &r->dropped, r->dropped + 1, __ATOMIC_RELAXED );
+        return;
+    }
+    rec             = &r->rec[ head & (TRACE_RING_SIZE - 1) ];
+    rec->wake_ns    = wake_ns;
+    rec->seq        = seq;
+    rec->latency_ns = (latency_ns > INT32_MAX) ? INT32_MAX : (int32_t)latency_ns;
+    rec->cpu        = cpu;
+    rec->thread     = thread;
+    __atomic_store_n( &r->head, head + 1, __ATOMIC_RELEASE );
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TRACE_H
@@ -0,0 +1,152 @@
+//
+// File:  tsc.c
+//
+// Cycle counter time stamps calibrated against CLOCK_MONOTONIC
+//
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "tsc.h"
+
+#define CALIBRATE_ns   100000000      // Initial calibration interval [ns]
+
+int          tsc_source = TSC_NONE;
+int          tsc_active = 0;
+tsc_calib_t  tsc_calib[2];
+
+//---------------------------------------------------------------------------
+
+static int64_t monotonic_ns( void )
+{
+    struct timespec  ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+// Read cycle counter and CLOCK_MONOTONIC as close to same time as possible
+// (take pair with shortest cycle count around clock_gettime())
+
+static void sample_pair( uint64_t *cycles, int64_t *ns )
+{
+    uint64_t  best = UINT64_MAX;
+
+    for ( int ix = 0; ix < 10; ix++ ) {
+        uint64_t  c1 = tsc_read();
+        int64_t   t  = monotonic_ns();
+        uint64_t  c2 = tsc_read();
+
+        if ( c2 - c1 < best ) {
+            best    = c2 - c1;
+            *cycles = c1 + (c2 - c1) / 2;
+            *ns     = t;
+        }
+    }
+}
+
+
+#if defined(__x86_64__) || defined(__i386__)
+// TSC is usable as time source only when its rate is constant (does not
+// follow CPU frequency) and it does not stop in deep C-states.
+
+static int invariant_tsc( void )
+{
+    char   line[4096];
+    int    constant = 0, nonstop = 0;
+
+    FILE *f = fopen( "/proc/cpuinfo", "r" );
+    if ( !f ) {
+        return 0;
+    }
+    while ( fgets(line, sizeof(line), f) ) {
+        if ( !strncmp(line, "flags", 5) ) {
+            constant = strstr( line, " constant_tsc" ) != NULL;
+            nonstop  = strstr( line, " nonstop_tsc"  ) != NULL;
+            break;
+        }
+    }
+    fclose( f );
+    return constant && nonstop;
+}
+#endif
+
+//---------------------------------------------------------------------------
+
+// Select cycle counter and calibrate it. Return 0 when cycle counter is
+// used, -1 when time stamps fall back to clock_gettime().
+
+int tsc_init( void )
+{
+    struct timespec  delay = { 0, CALIBRATE_ns };
+    uint64_t         c0, c1;
+    int64_t          t0, t1;
+
+#if defined(__x86_64__) || defined(__i386__)
+    if ( !invariant_tsc() ) {
+        printf("WARNING: TSC is not invariant, using clock_gettime()\n");
+        return -1;
+    }
+    tsc_source = TSC_X86;
+#elif defined(__aarch64__)
+    tsc_source = TSC_ARM64;
+#else
+    printf("WARNING: No cycle counter, using clock_gettime()\n");
+    return -1;
+#endif
+
+    sample_pair( &c0, &t0 );
+    nanosleep( &delay, NULL );
+    sample_pair( &c1, &t1 );
+
+    tsc_calib_t  *c = &tsc_calib[0];
+
+    c->base_cycles = c1;
+    c->base_ns     = t1;
+    c->mult        = ((uint64_t)(t1 - t0) << TSC_SHIFT) / (c1 - c0);
+    c->hz          = (uint64_t)((double)(c1 - c0) * 1e9 / (t1 - t0));
+    tsc_active     = 0;
+    return 0;
+}
+
+
+// Compare cycle counter time to CLOCK_MONOTONIC and recalibrate over
+// whole interval since previous calibration. Return drift [ns] (cycle
+// counter time - CLOCK_MONOTONIC) before recalibration.
+
+int64_t tsc_check_drift( void )
+{
+    tsc_calib_t  *c    = &tsc_calib[ tsc_active ];
+    tsc_calib_t  *next = &tsc_calib[ tsc_active ^ 1 ];
+    uint64_t      cycles;
+    int64_t       ns, drift;
+
+    if ( tsc_source == TSC_NONE ) {
+        return 0;
+    }
+    sample_pair( &cycles, &ns );
+    drift = tsc_cycles2ns( c, cycles ) - ns;
+
+    double  ratio = (double)(ns - c->base_ns) / (double)(cycles - c->base_cycles);
+
+    next->base_cycles = cycles;
+    next->base_ns     = ns;
+    next->mult        = (uint64_t)(ratio * (double)(1ULL << TSC_SHIFT));
+    next->hz          = (uint64_t)(1e9 / ratio);
+    __atomic_store_n( &tsc_active, tsc_active ^ 1, __ATOMIC_RELEASE );
+    return drift;
+}
+
+
+char *tsc_name( void )
+{
+    switch ( tsc_source ) {
+        case TSC_X86:    return "rdtsc";
+        case TSC_ARM64:  return "cntvct_el0";
+        default:         return "clock_gettime";
+    }
+}
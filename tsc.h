@@ -0,0 +1,102 @@
+//
+// File:  tsc.h
+//
+// Cycle counter time stamps calibrated against CLOCK_MONOTONIC
+//
+// - x86:    rdtsc (only when CPU has constant and nonstop TSC)
+// - ARM64:  cntvct_el0 (generic timer virtual counter)
+// - other:  clock_gettime( CLOCK_MONOTONIC ) fallback
+//
+// Conversion: ns = base_ns + ((cycles - base_cycles) * mult) >> 32
+//
+// Calibration is double buffered: tsc_check_drift() (low priority thread)
+// writes inactive calibration and switches "tsc_active" index, RT thread
+// reads without locks.
+//
+
+#ifndef  TSC_H
+#define  TSC_H
+
+#include <stdint.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#define TSC_NONE    0       // clock_gettime() fallback
+#define TSC_X86     1
+#define TSC_ARM64   2
+
+#define TSC_SHIFT   32
+
+typedef struct  {
+    uint64_t  base_cycles;
+    int64_t   base_ns;
+    uint64_t  mult;          // ns per cycle << TSC_SHIFT
+    uint64_t  hz;            // Cycle counter frequency
+} tsc_calib_t;
+
+extern int          tsc_source;
+extern int          tsc_active;
+extern tsc_calib_t  tsc_calib[2];
+
+int      tsc_init( void );
+int64_t  tsc_check_drift( void );
+char    *tsc_name( void );
+
+
+static inline uint64_t tsc_read( void )
+{
+#if defined(__x86_64__) || defined(__i386__)
+    uint32_t  lo, hi;
+
+    __asm__ __volatile__ ( "rdtsc" : "=a"(lo), "=d"(hi) );
+    return ((uint64_t)hi << 32) | lo;
+#elif defined(__aarch64__)
+    uint64_t  v;
+
+    __asm__ __volatile__ ( "isb; mrs %0, cntvct_el0" : "=r"(v) :: "memory" );
+    return v;
+#else
+    struct timespec  ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+
+static inline int64_t tsc_cycles2ns( tsc_calib_t *c, uint64_t cycles )
+{
+    uint64_t  delta = cycles - c->base_cycles;
+
+#if defined(__SIZEOF_INT128__)
+    return c->base_ns + (int64_t)(((unsigned __int128)delta * c->mult) >> TSC_SHIFT);
+#else
+    return c->base_ns + (int64_t)((delta >> 16) * (c->mult >> 16));
+#endif
+}
+
+
+// CLOCK_MONOTONIC nanoseconds from cycle counter (or clock_gettime fallback)
+
+static inline int64_t tsc_ns( void )
+{
+    if ( tsc_source == TSC_NONE ) {
+        struct timespec  ts;
+
+        clock_gettime( CLOCK_MONOTONIC, &ts );
+        return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    }
+    tsc_calib_t  *c = &tsc_calib[ __atomic_load_n(&tsc_active, __ATOMIC_ACQUIRE) ];
+
+    return tsc_cycles2ns( c, tsc_read() );
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TSC_H
@@ -0,0 +1,214 @@
+//
+// File:  uart.c
+//
+// Serial port loop back latency with sequence numbered frames (see uart.h)
+//
+
+#define _GNU_SOURCE              // posix_openpt(), cfmakeraw()
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "suppfunc.h"
+#include "tsc.h"
+#include "uart.h"
+
+#define SYNC            0xa5
+
+//---------------------------------------------------------------------------
+
+static int raw_tty( int fd )
+{
+    struct termios  tty;
+
+    if ( tcgetattr(fd, &tty) ) {
+        return -1;
+    }
+    cfmakeraw( &tty );
+    return tcsetattr( fd, TCSANOW, &tty );
+}
+
+
+// Open loop back "dev": "pty", "socketpair" or serial device (TX wired
+// to RX). Return 0 on success.
+
+int uart_open( uart_t *u, char *dev )
+{
+    struct epoll_event  ev = { .events = EPOLLIN };
+
+    memset( u, 0, sizeof(*u) );
+    u->tx_fd = u->rx_fd = u->epfd = -1;
+    u->name  = dev;
+
+    if ( !strcmp(dev, "pty") ) {
+        u->tx_fd = posix_openpt( O_RDWR | O_NOCTTY | O_NONBLOCK );
+        if ( (u->tx_fd < 0) || grantpt(u->tx_fd) || unlockpt(u->tx_fd) ) {
+            perror("pty");
+            uart_close( u );
+            return -1;
+        }
+        u->rx_fd = open( ptsname(u->tx_fd), O_RDWR | O_NOCTTY | O_NONBLOCK );
+        if ( (u->rx_fd < 0) || raw_tty(u->rx_fd) ) {
+            perror("pty slave");
+            uart_close( u );
+            return -1;
+        }
+    }
+    else if ( !strcmp(dev, "socketpair") ) {
+        int  sv[2];
+
+        if ( socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv) ) {
+            perror("socketpair");
+            return -1;
+        }
+        u->tx_fd = sv[0];
+        u->rx_fd = sv[1];
+    }
+    else {
+        u->tx_fd = open( dev, O_RDWR | O_NOCTTY | O_NONBLOCK );
+        if ( (u->tx_fd < 0) || set_interface_attribs(u->tx_fd, B115200, 0) ) {
+            perror( dev );
+            uart_close( u );
+            return -1;
+        }
+        raw_tty( u->tx_fd );
+        tcflush( u->tx_fd, TCIOFLUSH );
+        u->rx_fd = u->tx_fd;
+    }
+
+    u->epfd = epoll_create1( EPOLL_CLOEXEC );
+    if ( (u->epfd < 0) || epoll_ctl(u->epfd, EPOLL_CTL_ADD, u->rx_fd, &ev) ) {
+        perror("epoll");
+        uart_close( u );
+        return -1;
+    }
+    return 0;
+}
+
+
+void uart_close( uart_t *u )
+{
+    if ( u->epfd >= 0 ) {
+        close( u->epfd );
+    }
+    if ( (u->rx_fd >= 0) && (u->rx_fd != u->tx_fd) ) {
+        close( u->rx_fd );
+    }
+    if ( u->tx_fd >= 0 ) {
+        close( u->tx_fd );
+    }
+    u->tx_fd = u->rx_fd = u->epfd = -1;
+}
+
+//---------------------------------------------------------------------------
+
+// RT thread: send next frame, "now_ns" == send time (tsc_ns()).
+// Return 0 when sent, -1 when window is full or write failed.
+
+int uart_send( uart_t *u, int64_t now_ns )
+{
+    uint16_t  seq  = u->tx_seq;
+    uint16_t  base = __atomic_load_n( &u->rx_seq, __ATOMIC_RELAXED );
+    int       slot = seq & (UART_INFLIGHT - 1);
+    uint8_t   frame[UART_FRAME];
+
+    // Window full: wait for receiver, but not for ever when whole window
+    // is lost (receiver counts gap from next frame)
+    if ( ((uint16_t)(seq - base) >= UART_INFLIGHT) && (++u->tx_stall % UART_INFLIGHT) ) {
+        return -1;
+    }
+    frame[0] = SYNC;
+    frame[1] = seq & 0xff;
+    frame[2] = seq >> 8;
+    frame[3] = 0x5a ^ frame[1] ^ frame[2];
+
+    // Slot reuse: invalidate (seq - 1 never maps to this slot), then publish
+    __atomic_store_n( &u->sent_seq[slot], (uint16_t)(seq - 1), __ATOMIC_RELAXED );
+    __atomic_thread_fence( __ATOMIC_RELEASE );
+    u->sent_ns[slot] = now_ns;
+    __atomic_store_n( &u->sent_seq[slot], seq, __ATOMIC_RELEASE );
+    if ( write(u->tx_fd, frame, UART_FRAME) != UART_FRAME ) {
+        u->tx_drop++;
+        return -1;
+    }
+    u->tx_seq = seq + 1;
+    u->tx++;
+    return 0;
+}
+
+
+// Parse frames from receive buffer, return count of latencies
+
+static int parse( uart_t *u, int64_t *latency_ns, int max )
+{
+    uint8_t  *b = u->rx_buf;
+    int       ix = 0, n = 0;
+
+    while ( (n < max) && (ix + UART_FRAME <= u->rx_len) ) {
+        if ( (b[ix] != SYNC) || (b[ix + 3] != (0x5a ^ b[ix + 1] ^ b[ix + 2])) ) {
+            u->resync++;
+            ix++;
+            continue;
+        }
+        uint16_t  seq  = b[ix + 1] | (b[ix + 2] << 8);
+        int       slot = seq & (UART_INFLIGHT - 1);
+        int16_t   gap  = (int16_t)(seq - u->rx_seq);
+        int64_t   sent;
+
+        ix += UART_FRAME;
+        if ( gap < 0 ) {
+            continue;                  // Duplicate or older than lost window
+        }
+        u->lost += gap;
+        __atomic_store_n( &u->rx_seq, seq + 1, __ATOMIC_RELAXED );
+        u->rx++;
+        // Send time is valid when slot still has this frame
+        if ( __atomic_load_n(&u->sent_seq[slot], __ATOMIC_ACQUIRE) != seq ) {
+            continue;
+        }
+        sent = u->sent_ns[slot];
+        __atomic_thread_fence( __ATOMIC_ACQUIRE );
+        if ( __atomic_load_n(&u->sent_seq[slot], __ATOMIC_RELAXED) == seq ) {
+            latency_ns[n++] = u->rx_ns - sent;
+        }
+    }
+    memmove( b, b + ix, u->rx_len - ix );
+    u->rx_len -= ix;
+    return n;
+}
+
+
+// Receive thread: wait up to "timeout_ms" for frames and read all pending
+// bytes. Return count of latencies (max "max"), "now_ns" == receive time.
+
+int uart_recv( uart_t *u, int timeout_ms, int64_t *latency_ns, int64_t *now_ns, int max )
+{
+    struct epoll_event  ev;
+    int                 n = parse( u, latency_ns, max );
+
+    if ( !n ) {
+        if ( epoll_wait(u->epfd, &ev, 1, timeout_ms) <= 0 ) {
+            return 0;
+        }
+        u->rx_ns = tsc_ns();
+        while ( u->rx_len < UART_RX_BUF ) {
+            ssize_t  len = read( u->rx_fd, u->rx_buf + u->rx_len, UART_RX_BUF - u->rx_len );
+
+            if ( len <= 0 ) {
+                break;                 // EAGAIN: all pending bytes read
+            }
+            u->rx_len += len;
+        }
+        n = parse( u, latency_ns, max );
+    }
+    *now_ns = u->rx_ns;
+    return n;
+}
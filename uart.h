@@ -0,0 +1,63 @@
+//
+// File:  uart.h
+//
+// Serial port loop back latency with sequence numbered frames
+//
+// RT thread sends one frame each period, receive thread waits with epoll
+// and reads all pending bytes with non-blocking read(). Latency of frame is
+// receive time - send time of same sequence number, so lost or late frames
+// never shift later samples to wrong period. Up to UART_INFLIGHT frames
+// may be on the wire, sender drops frame (tx_stall) when window is full.
+//
+//      frame:  0xa5, seq low, seq high, 0x5a ^ seq low ^ seq high
+//
+// Loop back:
+//
+//      /dev/ttyX       TX wired to RX (115200 8N1 raw)
+//      pty             pseudo terminal pair: master -> slave
+//      socketpair      AF_UNIX stream socket pair
+//
+
+#ifndef  UART_H
+#define  UART_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#define UART_FRAME        4
+#define UART_INFLIGHT     16              // Must be power of two
+#define UART_RX_BUF       4096
+
+typedef struct  {
+    int       tx_fd, rx_fd, epfd;
+    char     *name;
+
+    // Sender (RT thread)
+    uint16_t  tx_seq;                     // Next sequence number
+    uint16_t  sent_seq[UART_INFLIGHT];    // Sequence number of slot (release)
+    int64_t   sent_ns[UART_INFLIGHT];     // Send time of slot
+    uint32_t  tx, tx_stall, tx_drop;      // Sent, window full, write failed
+
+    // Receiver
+    uint16_t  rx_seq;                     // Next expected sequence number
+    uint32_t  rx, lost, resync;           // Received, sequence gaps, bytes skipped
+    int       rx_len;
+    int64_t   rx_ns;                      // Receive time of bytes in buffer
+    uint8_t   rx_buf[UART_RX_BUF];
+} uart_t;
+
+
+int   uart_open( uart_t *u, char *dev );
+int   uart_send( uart_t *u, int64_t now_ns );
+int   uart_recv( uart_t *u, int timeout_ms, int64_t *latency_ns, int64_t *now_ns, int max );
+void  uart_close( uart_t *u );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // UART_H